@@ -10,8 +10,14 @@
 #include <infos/mm/mm.h>
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/log.h>
+#include <infos/kernel/cmdline.h>
 #include <infos/util/math.h>
 #include <infos/util/printf.h>
+#include <infos/util/lock.h>
+
+#include "cmdline-number.h"
+#include "cpu.h"
+#include "pgalloc-control.h"
 
 using namespace infos::kernel;
 using namespace infos::mm;
@@ -21,6 +27,50 @@ using namespace infos::util;
 // note to author: maximum value of order != number of orders)
 // 				   if you meant for this to be number of orders, you should have named it ORDER_COUNT
 
+// The smallest order of free block that is reported to the hypervisor, so that the host can reclaim
+// the memory behind it.
+#define REPORTING_ORDER		9
+
+// The number of unreported pages, in free blocks of at least the reporting order, that triggers a report.
+#define REPORTING_THRESHOLD	(32 * pages_per_block(REPORTING_ORDER))
+
+// The number of reporting-order chunks whose reported state is tracked (enough for 64GB of memory).
+#define REPORTED_CHUNKS		32768
+
+// The largest number of NUMA nodes that memory can be divided between.
+#define MAX_NODES		8
+
+// The ACPI SLIT distances used unless the command line says otherwise.
+#define LOCAL_DISTANCE		10
+#define REMOTE_DISTANCE		20
+
+// The order in which thread stacks are allocated.
+#define STACK_CACHE_ORDER	2
+
+// The most blocks that each CPU's stack cache can be configured to hold.
+#define STACK_CACHE_MAX		64
+
+// The number of blocks each CPU's stack cache holds, until the "pgalloc.stack-cache" option says otherwise.
+#define STACK_CACHE_DEFAULT	8
+
+// Memory is running low once less than this fraction (one in n) of it is free, at which point the stack
+// caches are drained, and stop caching.
+#define LOW_WATERMARK_FRACTION	64
+
+// The size of a page, as a power of two.
+#define PAGE_BITS		12
+
+// The most references a page can have beyond its first.
+#define MAX_EXTRA_REFS		0xffff
+
+// The number of entries in the table of pages available for merging (a power of two), and the most
+// that are used at once, so that probing stays short.
+#define MERGE_TABLE_SIZE	4096
+#define MERGE_TABLE_LIMIT	((MERGE_TABLE_SIZE * 3) / 4)
+
+// Marks a merge table entry whose page has been removed, so that probing continues past it.
+#define MERGE_TOMBSTONE		((PageDescriptor *)1)
+
 // #define DEBUGPRINT
 
 #ifdef DEBUGPRINT
@@ -29,6 +79,88 @@ using namespace infos::util;
 	#define debugf(...)
 #endif
 
+/*
+ * The firmware's NUMA tables (the ACPI SRAT and SLIT) are not parsed, so the layout must be given on the
+ * command line instead, to match the -numa options QEMU was started with:
+ *
+ *   pgalloc.numa-mem=<MiB>,<MiB>,...      the physical address each node's memory starts at, from node 0
+ *                                         (which must start at 0).  A hole in memory, such as the one
+ *                                         below 4GB for PCI, belongs to the node it lies in.
+ *   pgalloc.numa-cpus=<node>,<node>,...   the node of each CPU, in order of APIC ID.  CPUs that are not
+ *                                         listed are on node 0.
+ *   pgalloc.numa-distance=<d>,<d>,...     the distance from each node to each node, a row per node, as
+ *                                         in the SLIT.
+ *
+ * Without pgalloc.numa-mem, all of memory is one node.
+ */
+
+// The number of NUMA nodes, and the address (in MiB) each one's memory starts at.
+static unsigned int numa_nodes = 1;
+static unsigned int numa_node_start[MAX_NODES];
+
+RegisterCmdLineArgument(PgAllocNUMAMem, "pgalloc.numa-mem")
+{
+	unsigned int starts[MAX_NODES];
+	unsigned int nodes = parse_cmdline_list(value, starts, MAX_NODES);
+
+	bool ascending = nodes > 0 && starts[0] == 0;
+	for (unsigned int node = 1; ascending && node < nodes; node++) {
+		ascending = starts[node] > starts[node - 1];
+	}
+
+	if (!ascending) {
+		syslog.messagef(LogLevel::WARNING, "pgalloc.numa-mem: %s not supported (up to %u ascending addresses in MiB, from 0)", value, MAX_NODES);
+		return;
+	}
+
+	numa_nodes = nodes;
+	for (unsigned int node = 0; node < nodes; node++) {
+		numa_node_start[node] = starts[node];
+	}
+}
+
+// The number of CPUs whose node was given, and their nodes.
+static unsigned int numa_cpus;
+static unsigned int numa_cpu_node[MAX_CPUS];
+
+RegisterCmdLineArgument(PgAllocNUMACPUs, "pgalloc.numa-cpus")
+{
+	unsigned int cpus = parse_cmdline_list(value, numa_cpu_node, MAX_CPUS);
+	if (!cpus) {
+		syslog.messagef(LogLevel::WARNING, "pgalloc.numa-cpus: %s not supported (up to %u node numbers)", value, MAX_CPUS);
+	}
+
+	numa_cpus = cpus;
+}
+
+// The number of distances given, and the distances, a row per node.
+static unsigned int numa_distances;
+static unsigned int numa_distance[MAX_NODES * MAX_NODES];
+
+RegisterCmdLineArgument(PgAllocNUMADistance, "pgalloc.numa-distance")
+{
+	unsigned int distances = parse_cmdline_list(value, numa_distance, MAX_NODES * MAX_NODES);
+	if (!distances) {
+		syslog.messagef(LogLevel::WARNING, "pgalloc.numa-distance: %s not supported (up to %u distances)", value, MAX_NODES * MAX_NODES);
+	}
+
+	numa_distances = distances;
+}
+
+// The number of blocks each CPU's stack cache holds, set by the "pgalloc.stack-cache" command-line option.
+static unsigned int stack_cache_size = STACK_CACHE_DEFAULT;
+
+RegisterCmdLineArgument(PgAllocStackCache, "pgalloc.stack-cache")
+{
+	unsigned int size;
+	if (!parse_cmdline_number(value, size) || size > STACK_CACHE_MAX) {
+		syslog.messagef(LogLevel::WARNING, "pgalloc.stack-cache: %s blocks not supported (0 to %u)", value, STACK_CACHE_MAX);
+		return;
+	}
+
+	stack_cache_size = size;
+}
+
 /**
  * A buddy page allocation algorithm.
  */
@@ -101,9 +233,9 @@ private:
 	{
 		debugf("insert_block(%p, %d)", pgd, order);
 
-		// Starting from the _free_area array, find the slot in which the page descriptor
-		// should be inserted.
-		PageDescriptor **slot = &_free_areas[order];
+		// Starting from the _free_area array of the page's node, find the slot in which the page
+		// descriptor should be inserted.
+		PageDescriptor **slot = &_free_areas[node_of(pgd)][order];
 		
 		// Iterate whilst there is a slot, and whilst the page descriptor pointer is numerically
 		// greater than what the slot is pointing to.
@@ -114,6 +246,12 @@ private:
 		// Insert the page descriptor into the linked list.
 		pgd->next_free = *slot;
 		*slot = pgd;
+		_nr_free_pages += pages_per_block(order);
+
+		// Count the pages of a large block that the host has not been told about yet.
+		if (is_reportable(pgd, order)) {
+			_unreported_pages += unreported_pages_in(pgd, order);
+		}
 		
 		// Return the insert point (i.e. slot)
 		return slot;
@@ -127,8 +265,9 @@ private:
 	 */
 	void remove_block(PageDescriptor *pgd, int order)
 	{
-		// Starting from the _free_area array, iterate until the block has been located in the linked-list.
-		PageDescriptor **slot = &_free_areas[order];
+		// Starting from the _free_area array of the page's node, iterate until the block has been located
+		// in the linked-list.
+		PageDescriptor **slot = &_free_areas[node_of(pgd)][order];
 		while (*slot && pgd != *slot) {
 			slot = &(*slot)->next_free;
 		}
@@ -139,6 +278,73 @@ private:
 		// Remove the block from the free list.
 		*slot = pgd->next_free;
 		pgd->next_free = NULL;
+		_nr_free_pages -= pages_per_block(order);
+
+		// The block keeps its reported state, as it may only be being split or merged.  It is
+		// only cleared once some of the block is actually allocated.
+		if (is_reportable(pgd, order)) {
+			_unreported_pages -= unreported_pages_in(pgd, order);
+		}
+	}
+
+	/**
+	 * Returns TRUE if a free block could be reported to the hypervisor, i.e. it is large enough, and lies
+	 * within the range of memory whose reported state is tracked.
+	 * @param pgd The page descriptor of the block.
+	 * @param order The order of the block.
+	 */
+	static inline bool is_reportable(const PageDescriptor *pgd, int order)
+	{
+		return order >= REPORTING_ORDER && (sys.mm().pgalloc().pgd_to_pfn(pgd) >> REPORTING_ORDER) < REPORTED_CHUNKS;
+	}
+
+	/**
+	 * Returns the number of pages in a (reportable) free block that lie in chunks the hypervisor has
+	 * not been told are free.
+	 * @param pgd The page descriptor of the block.
+	 * @param order The order of the block.  Must be at least the reporting order.
+	 */
+	uint64_t unreported_pages_in(const PageDescriptor *pgd, int order) const
+	{
+		uint64_t chunk = sys.mm().pgalloc().pgd_to_pfn(pgd) >> REPORTING_ORDER;
+		uint64_t chunks = pages_per_block(order - REPORTING_ORDER);
+		uint64_t reported = 0;
+
+		// Count the reported chunks a word of the bitmap at a time.
+		while (chunks > 0) {
+			unsigned int bit = chunk % 64;
+			uint64_t count = chunks < 64 - bit ? chunks : 64 - bit;
+			uint64_t mask = count == 64 ? ~0ULL : ((1ULL << count) - 1) << bit;
+
+			reported += __builtin_popcountll(_reported[chunk / 64] & mask);
+
+			chunk += count;
+			chunks -= count;
+		}
+
+		return pages_per_block(order) - (reported * pages_per_block(REPORTING_ORDER));
+	}
+
+	/**
+	 * Marks each reporting-order chunk that a block overlaps as reported, or not.  A block smaller than
+	 * the reporting order marks the whole chunk that contains it.
+	 * @param pgd The page descriptor of the block.
+	 * @param order The order of the block.
+	 * @param reported Whether the block has been reported.
+	 */
+	void set_reported(const PageDescriptor *pgd, int order, bool reported)
+	{
+		uint64_t pfn = sys.mm().pgalloc().pgd_to_pfn(pgd);
+		uint64_t chunk = pfn >> REPORTING_ORDER;
+		uint64_t last_chunk = (pfn + pages_per_block(order) - 1) >> REPORTING_ORDER;
+
+		for (; chunk <= last_chunk && chunk < REPORTED_CHUNKS; chunk++) {
+			if (reported) {
+				_reported[chunk / 64] |= (1ULL << (chunk % 64));
+			} else {
+				_reported[chunk / 64] &= ~(1ULL << (chunk % 64));
+			}
+		}
 	}
 	
 	/**
@@ -237,22 +443,109 @@ public:
 	/**
 	 * Constructs a new instance of the Buddy Page Allocator.
 	 */
-	BuddyPageAllocator() {
-		// Iterate over each free area, and clear it.
-		for (unsigned int i = 0; i < ARRAY_SIZE(_free_areas); i++) {
-			_free_areas[i] = NULL;
+	BuddyPageAllocator() : _reporter(NULL), _reporter_priv(NULL),
+			_unreported_pages(0), _reported_pages(0), _nr_nodes(1), _stack_cache_hits(0), _stack_cache_drains(0),
+			_stack_cached(0), _base_pfn(0), _nr_pages(0), _nr_free_pages(0), _low_watermark(0), _extra_refs(NULL),
+			_zero_page(NULL), _merge_table(NULL), _merge_candidates(NULL), _merge_table_used(0), _merge_evict_next(0),
+			_merge_scanned(0), _merged_pages(0), _merged_zero_pages(0), _merge_evictions(0), _merge_scan_time(0) {
+		// Iterate over each node's free areas, and clear them.
+		for (unsigned int node = 0; node < MAX_NODES; node++) {
+			for (unsigned int i = 0; i < ARRAY_SIZE(_free_areas[node]); i++) {
+				_free_areas[node][i] = NULL;
+			}
+
+			_node_start_pfn[node] = 0;
+			_node_hits[node] = 0;
+			_node_misses[node] = 0;
+
+			for (unsigned int other = 0; other < MAX_NODES; other++) {
+				_node_distance[node][other] = node == other ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+			}
+		}
+
+		for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+			_cpu_node[cpu] = 0;
+			_stack_cache_count[cpu] = 0;
+		}
+
+		for (unsigned int i = 0; i < ARRAY_SIZE(_reported); i++) {
+			_reported[i] = 0;
 		}
 	}
 	
 	/**
-	 * Allocates 2^order number of contiguous pages
+	 * Allocates 2^order number of contiguous pages, preferably from the NUMA node of the calling CPU.
 	 * @param order The power of two, of the number of contiguous pages to allocate.
 	 * @return Returns a pointer to the first page descriptor for the newly allocated page range, or nullptr if
 	 * allocation failed.
 	 */
 	PageDescriptor *alloc_pages(int target_order) override
 	{
-		debugf("ALLOC_PAGES: target_order: %d", target_order)
+		// Finding out which CPU this is costs an RDTSCP at best, and a CPUID exit to the hypervisor
+		// at worst, so only do it when the answer matters: with more than one node.
+		if (_nr_nodes == 1) {
+			return alloc_pages_node(0, target_order);
+		}
+
+		return alloc_pages_node(_cpu_node[current_cpu() % MAX_CPUS], target_order);
+	}
+
+	/**
+	 * Allocates a kernel thread stack, of 2^STACK_CACHE_ORDER pages.  A stack recently freed on this CPU
+	 * is reused if there is one, to save splitting a block for every new thread, only to coalesce it
+	 * again when the thread exits.
+	 * @return Returns a pointer to the first page descriptor of the stack, or nullptr if allocation failed.
+	 */
+	PageDescriptor *alloc_stack()
+	{
+		if (stack_cache_size > 0) {
+			unsigned int cpu = current_cpu() % MAX_CPUS;
+
+			if (_stack_cache_count[cpu] > 0) {
+				_stack_cache_hits++;
+				_stack_cached--;
+				return _stack_cache[cpu][--_stack_cache_count[cpu]];
+			}
+		}
+
+		return alloc_pages(STACK_CACHE_ORDER);
+	}
+
+	/**
+	 * Frees a kernel thread stack, as allocated by alloc_stack().  It is kept for this CPU to reuse if
+	 * there is room in its cache, unless memory is running low.
+	 * @param pgd A pointer to the first page descriptor of the stack.
+	 */
+	void free_stack(PageDescriptor *pgd)
+	{
+		if (stack_cache_size > 0 && _nr_free_pages >= _low_watermark) {
+			unsigned int cpu = current_cpu() % MAX_CPUS;
+
+			if (_stack_cache_count[cpu] < stack_cache_size) {
+				_stack_cache[cpu][_stack_cache_count[cpu]++] = pgd;
+				_stack_cached++;
+				return;
+			}
+		}
+
+		free_pages(pgd, STACK_CACHE_ORDER);
+	}
+
+	/**
+	 * Allocates 2^order number of contiguous pages, preferably from the given NUMA node.  If the node has no
+	 * suitable block free, the other nodes are tried, nearest first.
+	 * @param node The node to allocate from.
+	 * @param order The power of two, of the number of contiguous pages to allocate.
+	 * @return Returns a pointer to the first page descriptor for the newly allocated page range, or nullptr if
+	 * allocation failed.
+	 */
+	PageDescriptor *alloc_pages_node(unsigned int node, int target_order)
+	{
+		debugf("ALLOC_PAGES: node: %u, target_order: %d", node, target_order)
+
+		if (node >= _nr_nodes) {
+			node = 0;
+		}
 
 		// Ensure order is valid
 		assert(target_order >= 0);
@@ -260,9 +553,52 @@ public:
 
 		debugf("ALLOC_PAGES: assertion success");
 
+		PageDescriptor *block = alloc_block(node, target_order);
+		if (block) {
+			_node_hits[node]++;
+		} else {
+			// Fall back to the other nodes, in order of distance.
+			for (unsigned int i = 1; i < _nr_nodes && !block; i++) {
+				block = alloc_block(_node_fallback[node][i], target_order);
+			}
+
+			if (block) {
+				_node_misses[node]++;
+			}
+		}
+
+		if (block) {
+			// Give the cached stacks back as soon as memory runs low, rather than waiting for it to
+			// run out.
+			if (_nr_free_pages < _low_watermark && _stack_cached) {
+				drain_stack_caches();
+			}
+
+			return block;
+		}
+
+		// As a last resort, give back whatever the stack caches are holding, and try again.
+		if (drain_stack_caches()) {
+			return alloc_pages_node(node, target_order);
+		}
+
+		return nullptr;
+	}
+
+	/**
+	 * Allocates 2^order number of contiguous pages, from a node's free lists as they are.
+	 * @param node The node to allocate from.
+	 * @param order The power of two, of the number of contiguous pages to allocate.
+	 * @return Returns a pointer to the first page descriptor for the newly allocated page range, or nullptr if
+	 * allocation failed.
+	 */
+	PageDescriptor *alloc_block(unsigned int node, int target_order)
+	{
+		auto free_areas = _free_areas[node];
+
 		// Start off with the target order
 		int current_order = target_order;
-		auto free_block = _free_areas[current_order];
+		auto free_block = free_areas[current_order];
 
 		while (!free_block || current_order > target_order) {
 			// debugf("***** WHILE DUMP START")
@@ -276,10 +612,10 @@ public:
 			}
 
 			// If the current order is splittable...
-			if (_free_areas[current_order]) {
+			if (free_areas[current_order]) {
 				// Split and decrement
-				debugf("ALLOC_PAGES: splitting up free area %p (current_order: %d)", _free_areas[current_order], current_order);
-				free_block = split_block(&_free_areas[current_order], current_order);
+				debugf("ALLOC_PAGES: splitting up free area %p (current_order: %d)", free_areas[current_order], current_order);
+				free_block = split_block(&free_areas[current_order], current_order);
 				current_order--;
 				debugf("ALLOC_PAGES: split complete")
 			} else {
@@ -288,8 +624,10 @@ public:
 			}
 		}
 
-		// Remove the block from the free areas, and return it
+		// Remove the block from the free areas, and return it.  The host has to be told about its
+		// chunks again, once they are free again.
 		remove_block(free_block, target_order);
+		set_reported(free_block, target_order, false);
 
 		debugf("ALLOC_PAGES: returning %p", free_block)
 		return free_block;
@@ -303,7 +641,7 @@ public:
 	 */
 	PageDescriptor** is_page_free(PageDescriptor* pgd, int order)
 	{
-		auto slot = &_free_areas[order];
+		auto slot = &_free_areas[node_of(pgd)][order];
 		while (*slot != nullptr) {
 			if (*slot == pgd) {
 				return slot;
@@ -370,8 +708,11 @@ public:
 			return CoalesceResult{pgd, order};
 		}
 
+		// Blocks never merge across nodes, as node boundaries need not be aligned to any order.
+		unsigned int node = node_of(pgd);
+
 		auto buddy = buddy_of(pgd, order);
-		while (is_page_free(buddy, order) != nullptr) {
+		while (node_of(buddy) == node && is_page_free(buddy, order) != nullptr) {
 			// Since the buddy is free, merge ourselves and the buddy. Always returns the LHS.
 			pgd = *merge_block(&pgd, order);
 
@@ -406,6 +747,11 @@ public:
 		assert(order >= 0);
 		assert(order <= MAX_ORDER);
 
+		// Pages that are still shared are not freed, but lose a reference.
+		if (_extra_refs && put_shared_pages(pgd, order)) {
+			return;
+		}
+
 		// Free these pages straight away.
 		insert_block(pgd, order);
 
@@ -413,6 +759,228 @@ public:
 		coalesce(pgd, order);
 	}
 
+	/**
+	 * Takes an extra reference to an allocated page, e.g. when it becomes shared between two address spaces
+	 * for copy-on-write.  References are always to a single page, even one that was allocated as part of a
+	 * larger block: the reference is dropped by freeing that page alone, with free_pages(pgd, 0), whereas
+	 * freeing the whole block drops the allocation's own reference to each of its pages.  A page only goes
+	 * back to the free lists once every reference to it has been dropped.
+	 * @param pgd The page descriptor of the page.
+	 * @return Returns TRUE if the reference was taken, FALSE if there was no memory to count references in,
+	 * or the page has too many references already.
+	 */
+	bool get_page(PageDescriptor *pgd)
+	{
+		if (!_extra_refs) {
+			_extra_refs = (uint16_t *)alloc_metadata(_nr_pages * sizeof(*_extra_refs));
+			if (!_extra_refs) {
+				return false;
+			}
+		}
+
+		uint16_t *refs = &_extra_refs[sys.mm().pgalloc().pgd_to_pfn(pgd) - _base_pfn];
+		if (*refs == MAX_EXTRA_REFS) {
+			return false;
+		}
+
+		(*refs)++;
+		return true;
+	}
+
+	/**
+	 * Returns the number of references to an allocated page.
+	 * @param pgd The page descriptor of the page.
+	 */
+	unsigned int page_refcount(const PageDescriptor *pgd) const
+	{
+		return 1 + (_extra_refs ? _extra_refs[sys.mm().pgalloc().pgd_to_pfn(pgd) - _base_pfn] : 0);
+	}
+
+	/**
+	 * Looks for a page with the same contents as the given one, so that the two can be merged into a single
+	 * shared page.  Pages that are entirely zero are merged into one shared zero page.  Every mapping of the
+	 * page must already be read-only (copy-on-write), so that its contents cannot change underneath the merge.
+	 * A page with nothing to merge with is kept in a table, for later pages to merge into, until its owner
+	 * frees it or the table needs the room.  Finding the candidate pages is up to the caller, which must walk
+	 * the address spaces that map them.
+	 * @param pgd The page descriptor of an allocated (order-0) page.
+	 * @return Returns the page that should be mapped in place of the given one, with a reference taken for
+	 * the caller.  If this is not the given page, the caller should remap it, and then free the given page.
+	 */
+	PageDescriptor *merge_page(PageDescriptor *pgd)
+	{
+		auto start = sys.runtime();
+		auto merged = find_merge_target(pgd);
+		_merge_scan_time += sys.runtime() - start;
+		_merge_scanned++;
+
+		if (merged == pgd) {
+			return pgd;
+		}
+
+		if (merged == _zero_page) {
+			_merged_zero_pages++;
+		} else {
+			_merged_pages++;
+		}
+
+		return merged;
+	}
+
+	/**
+	 * Returns the number of pages that have been passed to merge_page().
+	 */
+	uint64_t merge_scanned_pages() const { return _merge_scanned; }
+
+	/**
+	 * Returns the number of pages that merge_page() found a duplicate of, and so could be freed.
+	 */
+	uint64_t merged_pages() const { return _merged_pages + _merged_zero_pages; }
+
+	/**
+	 * Returns the number of those merged pages that were merged into the shared zero page.
+	 */
+	uint64_t merged_zero_pages() const { return _merged_zero_pages; }
+
+	/**
+	 * Returns the number of pages that were dropped from the merge table to make room for others.
+	 */
+	uint64_t merge_evictions() const { return _merge_evictions; }
+
+	/**
+	 * Returns the total time, in nanoseconds, spent hashing and comparing pages in merge_page().
+	 */
+	uint64_t merge_scan_time() const { return _merge_scan_time; }
+
+	/**
+	 * Returns every block held in the per-CPU stack caches to the free lists.
+	 * @return Returns TRUE if any blocks were returned, FALSE if the caches were empty.
+	 */
+	bool drain_stack_caches()
+	{
+		bool drained = false;
+
+		for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+			while (_stack_cache_count[cpu] > 0) {
+				auto pgd = _stack_cache[cpu][--_stack_cache_count[cpu]];
+
+				insert_block(pgd, STACK_CACHE_ORDER);
+				coalesce(pgd, STACK_CACHE_ORDER);
+
+				drained = true;
+			}
+		}
+
+		_stack_cached = 0;
+
+		if (drained) {
+			_stack_cache_drains++;
+		}
+
+		return drained;
+	}
+
+	/**
+	 * Returns the number of allocations that were satisfied from a stack cache.
+	 */
+	uint64_t stack_cache_hits() const { return _stack_cache_hits; }
+
+	/**
+	 * Returns the number of times the stack caches have been drained because memory was running low.
+	 */
+	uint64_t stack_cache_drains() const { return _stack_cache_drains; }
+
+	/**
+	 * Sets the function that reports free blocks to the hypervisor, e.g. through a virtio-balloon
+	 * free page reporting queue.
+	 * @param reporter The function to call for each newly reported block, or NULL to stop reporting.
+	 * @param priv A pointer that is passed to the reporter.
+	 */
+	void set_free_page_reporter(FreePageReporter reporter, void *priv)
+	{
+		UniqueIRQLock l;
+
+		_reporter = reporter;
+		_reporter_priv = priv;
+	}
+
+	/**
+	 * Reports every free block, of at least the reporting order, that has not already been reported,
+	 * once there are at least REPORTING_THRESHOLD pages of them.  Each block is taken off the free
+	 * lists whilst the host is told about it, so interrupts are only disabled to find the block and
+	 * to put it back.  If some of a block has been reported already (e.g. it was merged with a block
+	 * that had been reported), only its other chunks are reported.
+	 * @warning Reporting is slow, so this must be called from a thread, never when pages are freed.
+	 * @return Returns the number of pages that were reported.
+	 */
+	uint64_t report_free_pages()
+	{
+		if (__atomic_load_n(&_unreported_pages, __ATOMIC_RELAXED) < REPORTING_THRESHOLD) {
+			return 0;
+		}
+
+		uint64_t reported = 0;
+
+		for (;;) {
+			FreePageReporter reporter;
+			void *priv;
+			PageDescriptor *block;
+			int order;
+			uint64_t unreported;
+
+			{
+				// You must make sure that interrupts are
+				// disabled when manipulating the free lists.
+				UniqueIRQLock l;
+
+				reporter = _reporter;
+				priv = _reporter_priv;
+				if (!reporter || !find_unreported_block(block, order)) {
+					break;
+				}
+
+				unreported = unreported_pages_in(block, order);
+				remove_block(block, order);
+			}
+
+			if (unreported == pages_per_block(order)) {
+				reporter(block, order, priv);
+			} else {
+				for (uint64_t chunk = 0; chunk < pages_per_block(order - REPORTING_ORDER); chunk++) {
+					auto chunk_pgd = block + (chunk * pages_per_block(REPORTING_ORDER));
+					if (unreported_pages_in(chunk_pgd, REPORTING_ORDER)) {
+						reporter(chunk_pgd, REPORTING_ORDER, priv);
+					}
+				}
+			}
+
+			{
+				UniqueIRQLock l;
+
+				set_reported(block, order, true);
+				insert_block(block, order);
+				coalesce(block, order);
+
+				_reported_pages += unreported;
+			}
+
+			reported += unreported;
+		}
+
+		debugf("REPORT_FREE_PAGES: reported %lu pages", reported);
+		return reported;
+	}
+
+	/**
+	 * Returns the total number of pages that have been reported to the hypervisor.
+	 */
+	uint64_t reported_pages() const { return _reported_pages; }
+
+	/**
+	 * The instance the kernel is allocating with: the one that has been initialised.
+	 */
+	static BuddyPageAllocator *active;
+
 	/**
 	 * Reserves a specific page, so that it cannot be allocated.
 	 * @param pgd The page descriptor of the page to reserve.
@@ -442,6 +1010,7 @@ public:
 
 				debugf("RESERVE_PAGE returning true (removing %p)", *slot)
 				remove_block(*slot, 0);
+				set_reported(pgd, 0, false);
 				return true;
 			}
 
@@ -468,8 +1037,8 @@ public:
 				continue;
 			}
 
-			// Search through the free areas, starting off with the first free area of this order
-			current_block = _free_areas[order];
+			// Search through the free areas of the page's node, starting off with the first free area of this order
+			current_block = _free_areas[node_of(pgd)][order];
 			while (current_block != nullptr) {
 
 				// If pgd is between (inclusive) the current block and the last page of that block...
@@ -487,6 +1056,11 @@ public:
 			}
 		}
 
+		// The page may be sitting in a stack cache, so give those back and look again.
+		if (drain_stack_caches()) {
+			return reserve_page(pgd);
+		}
+
 		// Couldn't find, so we're done!
 		debugf("RESERVE_PAGE returning false")
 		return false;
@@ -499,31 +1073,117 @@ public:
 	bool init(PageDescriptor *page_descriptors, uint64_t nr_page_descriptors) override
 	{
 		mm_log.messagef(LogLevel::DEBUG, "Buddy Allocator Initialising pd=%p, nr=0x%lx", page_descriptors, nr_page_descriptors);
-		
-		// Initialise the free area linked list for the maximum order
-		// to initialise the allocation algorithm.
-		auto order = MAX_ORDER;
-		uint64_t remaining_pages = nr_page_descriptors;
 
-		do {
-			auto block_size = pages_per_block(order);
-			auto surplus_pages = remaining_pages % block_size;
-			auto block_count = (remaining_pages - surplus_pages) / block_size;
-			auto last_block = page_descriptors + (block_count * block_size);
+		active = this;
 
-			while (page_descriptors < last_block) {
-				insert_block(page_descriptors, order);
-				page_descriptors += block_size;
-				remaining_pages -= block_size;
+		_base_pfn = sys.mm().pgalloc().pgd_to_pfn(page_descriptors);
+		_nr_pages = nr_page_descriptors;
+		_low_watermark = nr_page_descriptors / LOW_WATERMARK_FRACTION;
+
+		uint64_t end_pfn = _base_pfn + nr_page_descriptors;
+
+		// Divide memory between the nodes as the command line says, leaving out any node that would
+		// have none of it.
+		_nr_nodes = 1;
+		_node_start_pfn[0] = _base_pfn;
+
+		for (unsigned int node = 1; node < numa_nodes; node++) {
+			uint64_t start_pfn = ((uint64_t)numa_node_start[node] << 20) >> PAGE_BITS;
+			if (start_pfn <= _base_pfn || start_pfn >= end_pfn) {
+				mm_log.messagef(LogLevel::WARNING, "pgalloc.numa-mem: node %u starts outside memory, so is left out", node);
+				break;
 			}
 
-			order--;
-		} while (remaining_pages > 0);
+			_node_start_pfn[_nr_nodes++] = start_pfn;
+		}
+
+		for (unsigned int cpu = 0; cpu < numa_cpus; cpu++) {
+			if (numa_cpu_node[cpu] >= _nr_nodes) {
+				mm_log.messagef(LogLevel::WARNING, "pgalloc.numa-cpus: CPU %u is on node %u, which does not exist", cpu, numa_cpu_node[cpu]);
+				continue;
+			}
+
+			set_cpu_node(cpu, numa_cpu_node[cpu]);
+		}
+
+		if (numa_distances == _nr_nodes * _nr_nodes) {
+			for (unsigned int from = 0; from < _nr_nodes; from++) {
+				for (unsigned int to = 0; to < _nr_nodes; to++) {
+					set_node_distance(from, to, numa_distance[(from * _nr_nodes) + to]);
+				}
+			}
+		} else if (numa_distances) {
+			mm_log.messagef(LogLevel::WARNING, "pgalloc.numa-distance: %u distances given, for %u nodes", numa_distances, _nr_nodes);
+		}
+
+		update_node_fallback();
+
+		// Hand each node's memory to its free lists in the largest aligned blocks that fit, so that
+		// no block ever straddles two nodes.
+		for (unsigned int node = 0; node < _nr_nodes; node++) {
+			uint64_t pfn = _node_start_pfn[node];
+			uint64_t node_end_pfn = node + 1 < _nr_nodes ? _node_start_pfn[node + 1] : end_pfn;
+
+			while (pfn < node_end_pfn) {
+				int order = MAX_ORDER;
+				while (order > 0 && ((pfn % pages_per_block(order)) || pfn + pages_per_block(order) > node_end_pfn)) {
+					order--;
+				}
+
+				insert_block(sys.mm().pgalloc().pfn_to_pgd(pfn), order);
+				pfn += pages_per_block(order);
+			}
+		}
 
 		debugf("INIT: done initialising buddy algorithm")
 		return true;
 	}
 
+	/**
+	 * Sets the distance from one NUMA node to another, as given by "pgalloc.numa-distance".  As in the
+	 * SLIT, the distance back may differ.
+	 * @param from The node allocating.
+	 * @param to The node being allocated from.
+	 * @param distance The relative distance, where LOCAL_DISTANCE is the distance from a node to itself.
+	 */
+	void set_node_distance(unsigned int from, unsigned int to, unsigned int distance)
+	{
+		if (from >= MAX_NODES || to >= MAX_NODES) {
+			return;
+		}
+
+		_node_distance[from][to] = distance;
+
+		update_node_fallback();
+	}
+
+	/**
+	 * Sets the NUMA node that a CPU belongs to, as given by "pgalloc.numa-cpus".
+	 * @param cpu The CPU to update.
+	 * @param node The node the CPU belongs to.
+	 */
+	void set_cpu_node(unsigned int cpu, unsigned int node)
+	{
+		if (cpu < MAX_CPUS && node < _nr_nodes) {
+			_cpu_node[cpu] = node;
+		}
+	}
+
+	/**
+	 * Returns the number of NUMA nodes that memory is divided between.
+	 */
+	unsigned int nr_nodes() const { return _nr_nodes; }
+
+	/**
+	 * Returns the number of allocations that preferred the given node, and were satisfied from it.
+	 */
+	uint64_t node_hits(unsigned int node) const { return node < MAX_NODES ? _node_hits[node] : 0; }
+
+	/**
+	 * Returns the number of allocations that preferred the given node, but had to be satisfied from another.
+	 */
+	uint64_t node_misses(unsigned int node) const { return node < MAX_NODES ? _node_misses[node] : 0; }
+
 	/**
 	 * Returns the friendly name of the allocation algorithm, for debugging and selection purposes.
 	 */
@@ -537,28 +1197,516 @@ public:
 		// Print out a header, so we can find the output in the logs.
 		mm_log.messagef(LogLevel::DEBUG, "BUDDY STATE:");
 		
-		// Iterate over each free area.
-		for (unsigned int i = 0; i < ARRAY_SIZE(_free_areas); i++) {
-			char buffer[256];
-			snprintf(buffer, sizeof(buffer), "[%d] ", i);
-						
-			// Iterate over each block in the free area.
-			PageDescriptor *pg = _free_areas[i];
-			while (pg) {
-				// Append the PFN of the free block to the output buffer.
-				snprintf(buffer, sizeof(buffer), "%s%lx ", buffer, sys.mm().pgalloc().pgd_to_pfn(pg));
-				pg = pg->next_free;
+		// Iterate over each node's free areas.
+		for (unsigned int node = 0; node < _nr_nodes; node++) {
+			if (_nr_nodes > 1) {
+				mm_log.messagef(LogLevel::DEBUG, "NODE %u: hits=%lu misses=%lu", node, _node_hits[node], _node_misses[node]);
+			}
+
+			for (unsigned int i = 0; i < ARRAY_SIZE(_free_areas[node]); i++) {
+				char buffer[256];
+				unsigned int length = snprintf(buffer, sizeof(buffer), "[%d] ", i);
+
+				// Iterate over each block in the free area.
+				PageDescriptor *pg = _free_areas[node][i];
+				while (pg && length < sizeof(buffer)) {
+					// Append the PFN of the free block to the output buffer.
+					length += snprintf(buffer + length, sizeof(buffer) - length, "%lx ", sys.mm().pgalloc().pgd_to_pfn(pg));
+					pg = pg->next_free;
+				}
+
+				mm_log.messagef(LogLevel::DEBUG, "%s", buffer);
 			}
-			
-			mm_log.messagef(LogLevel::DEBUG, "%s", buffer);
+		}
+
+		if (_merge_scanned) {
+			mm_log.messagef(LogLevel::DEBUG, "MERGE: scanned=%lu merged=%lu zero=%lu evicted=%lu time=%luns", _merge_scanned,
+					_merged_pages + _merged_zero_pages, _merged_zero_pages, _merge_evictions, _merge_scan_time);
 		}
 	}
 
 	
 private:
-	PageDescriptor *_free_areas[MAX_ORDER+1];
+	/**
+	 * Drops the allocation's reference to each page of a block in which some pages are shared.  Pages are
+	 * only ever shared on their own (see get_page()), so each page is checked: shared pages lose an extra
+	 * reference, and the others are freed one by one, to coalesce with the rest of the block as the shared
+	 * pages are freed in turn.
+	 * @param pgd A pointer to an array of page descriptors.
+	 * @param order The power of two number of contiguous pages.
+	 * @return Returns TRUE if any page was shared, or FALSE (having done nothing) if none were, in which
+	 * case the block can be freed as a whole.
+	 */
+	bool put_shared_pages(PageDescriptor *pgd, int order)
+	{
+		uint16_t *refs = &_extra_refs[sys.mm().pgalloc().pgd_to_pfn(pgd) - _base_pfn];
+
+		uint64_t i = 0;
+		while (i < pages_per_block(order) && !refs[i]) {
+			i++;
+		}
+
+		if (i == pages_per_block(order)) {
+			return false;
+		}
+
+		for (i = 0; i < pages_per_block(order); i++) {
+			// A page in the merge table that loses its last reference but the table's own is of no
+			// use to anyone, so is dropped from the table and freed too.
+			if (!refs[i] || (!--refs[i] && forget_merge_candidate(pgd + i))) {
+				insert_block(pgd + i, 0);
+				coalesce(pgd + i, 0);
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Allocates zeroed memory for the allocator's own use, such as the extra reference counts, the first
+	 * time it is needed.  It is taken from the allocator's own free lists, as the kernel heap itself
+	 * allocates pages from here.
+	 * @param size The number of bytes needed.
+	 * @return Returns the (virtual) address of the memory, or NULL if it could not be allocated.
+	 */
+	void *alloc_metadata(uint64_t size)
+	{
+		int order = 0;
+		while (order < MAX_ORDER && (pages_per_block(order) << PAGE_BITS) < size) {
+			order++;
+		}
+
+		if ((pages_per_block(order) << PAGE_BITS) < size) {
+			return NULL;
+		}
+
+		auto block = alloc_pages_node(0, order);
+		if (!block) {
+			return NULL;
+		}
+
+		auto words = (uint64_t *)sys.mm().pgalloc().pgd_to_vpa(block);
+		for (uint64_t i = 0; i < (pages_per_block(order) << PAGE_BITS) / sizeof(*words); i++) {
+			words[i] = 0;
+		}
+
+		return words;
+	}
+
+	/**
+	 * An entry in the table of pages available for merging.  The table holds a reference to each page, so
+	 * that its owner copies it before writing to it, but only for as long as somebody else does too.
+	 */
+	struct MergeEntry
+	{
+		PageDescriptor *pgd;
+		uint64_t hash;
+	};
+
+	/**
+	 * Hashes the contents of a page (FNV-1a, a word at a time).
+	 * @param pgd The page descriptor of the page.
+	 * @param zero Set to TRUE if the page is entirely zero.
+	 */
+	static uint64_t hash_page(const PageDescriptor *pgd, bool& zero)
+	{
+		auto words = (const uint64_t *)sys.mm().pgalloc().pgd_to_vpa(pgd);
+
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		uint64_t bits = 0;
+
+		for (unsigned int i = 0; i < (1 << PAGE_BITS) / sizeof(*words); i++) {
+			hash = (hash ^ words[i]) * 0x100000001b3ULL;
+			bits |= words[i];
+		}
+
+		zero = bits == 0;
+		return hash;
+	}
+
+	/**
+	 * Returns TRUE if two pages have exactly the same contents.
+	 */
+	static bool same_contents(const PageDescriptor *a, const PageDescriptor *b)
+	{
+		auto words_a = (const uint64_t *)sys.mm().pgalloc().pgd_to_vpa(a);
+		auto words_b = (const uint64_t *)sys.mm().pgalloc().pgd_to_vpa(b);
+
+		for (unsigned int i = 0; i < (1 << PAGE_BITS) / sizeof(*words_a); i++) {
+			if (words_a[i] != words_b[i]) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Returns TRUE if the given page is in the merge table.
+	 */
+	bool is_merge_candidate(const PageDescriptor *pgd) const
+	{
+		uint64_t index = sys.mm().pgalloc().pgd_to_pfn(pgd) - _base_pfn;
+		return _merge_candidates && (_merge_candidates[index / 64] & (1ULL << (index % 64)));
+	}
+
+	/**
+	 * Removes a page from the merge table, if it is there.  The table's reference to the page is left for
+	 * the caller to drop.
+	 * @param pgd The page descriptor of the page.
+	 * @return Returns TRUE if the page was in the table, FALSE otherwise.
+	 */
+	bool forget_merge_candidate(PageDescriptor *pgd)
+	{
+		if (!is_merge_candidate(pgd)) {
+			return false;
+		}
+
+		uint64_t index = sys.mm().pgalloc().pgd_to_pfn(pgd) - _base_pfn;
+		_merge_candidates[index / 64] &= ~(1ULL << (index % 64));
+
+		for (unsigned int i = 0; i < MERGE_TABLE_SIZE; i++) {
+			if (_merge_table[i].pgd == pgd) {
+				_merge_table[i].pgd = MERGE_TOMBSTONE;
+				_merge_table_used--;
+				break;
+			}
+		}
+
+		// Once the table is empty, the tombstones can go too.
+		if (_merge_table_used == 0) {
+			for (unsigned int i = 0; i < MERGE_TABLE_SIZE; i++) {
+				_merge_table[i].pgd = NULL;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Makes room in the merge table by dropping the next page in it, round-robin, leaving the page to
+	 * whoever else refers to it.
+	 */
+	void evict_merge_candidate()
+	{
+		while (_merge_table[_merge_evict_next].pgd <= MERGE_TOMBSTONE) {
+			_merge_evict_next = (_merge_evict_next + 1) & (MERGE_TABLE_SIZE - 1);
+		}
+
+		auto pgd = _merge_table[_merge_evict_next].pgd;
+		forget_merge_candidate(pgd);
+		free_pages(pgd, 0);
+
+		_merge_evictions++;
+	}
+
+	/**
+	 * Finds the page that a page should be merged into: the shared zero page, or a page with the same contents
+	 * from the merge table.  If there is none, the page is added to the table, for later pages to merge into.
+	 * @param pgd The page descriptor of the page.
+	 * @return Returns the page to merge into (with a reference taken), or the given page if there is none.
+	 */
+	PageDescriptor *find_merge_target(PageDescriptor *pgd)
+	{
+		bool zero;
+		uint64_t hash = hash_page(pgd, zero);
+
+		if (zero) {
+			if (!_zero_page) {
+				// The page itself becomes the shared zero page, with the allocator's own reference.
+				if (!get_page(pgd)) {
+					return pgd;
+				}
+
+				_zero_page = pgd;
+				return pgd;
+			}
+
+			return get_page(_zero_page) ? _zero_page : pgd;
+		}
+
+		if (!_merge_table) {
+			_merge_candidates = (uint64_t *)alloc_metadata(((_nr_pages + 63) / 64) * sizeof(*_merge_candidates));
+			if (!_merge_candidates) {
+				return pgd;
+			}
+
+			_merge_table = (MergeEntry *)alloc_metadata(MERGE_TABLE_SIZE * sizeof(*_merge_table));
+			if (!_merge_table) {
+				return pgd;
+			}
+		}
+
+		// Keep the table to its limit, by making room for the newest page.
+		if (_merge_table_used >= MERGE_TABLE_LIMIT) {
+			evict_merge_candidate();
+		}
+
+		MergeEntry *free_entry = NULL;
+
+		for (unsigned int i = 0; i < MERGE_TABLE_SIZE; i++) {
+			auto entry = &_merge_table[(hash + i) & (MERGE_TABLE_SIZE - 1)];
+
+			if (entry->pgd == NULL) {
+				if (!free_entry) {
+					free_entry = entry;
+				}
+
+				break;
+			}
+
+			if (entry->pgd == MERGE_TOMBSTONE) {
+				if (!free_entry) {
+					free_entry = entry;
+				}
+
+				continue;
+			}
+
+			if (entry->pgd == pgd) {
+				return pgd;
+			}
+
+			if (entry->hash == hash && same_contents(entry->pgd, pgd) && get_page(entry->pgd)) {
+				return entry->pgd;
+			}
+		}
+
+		// Nothing to merge with, so offer this page up for later pages to merge with instead.
+		if (free_entry && get_page(pgd)) {
+			uint64_t index = sys.mm().pgalloc().pgd_to_pfn(pgd) - _base_pfn;
+			_merge_candidates[index / 64] |= 1ULL << (index % 64);
+
+			free_entry->pgd = pgd;
+			free_entry->hash = hash;
+			_merge_table_used++;
+		}
+
+		return pgd;
+	}
+
+	/**
+	 * Finds a free block, of at least the reporting order, with chunks that have not been reported.
+	 * @param block Populated with the block, if there is one.
+	 * @param order Populated with the order of the block, if there is one.
+	 * @return Returns TRUE if such a block was found, FALSE otherwise.
+	 */
+	bool find_unreported_block(PageDescriptor *&block, int& order)
+	{
+		for (unsigned int node = 0; node < _nr_nodes; node++) {
+			for (order = MAX_ORDER; order >= REPORTING_ORDER; order--) {
+				for (block = _free_areas[node][order]; block; block = block->next_free) {
+					if (is_reportable(block, order) && unreported_pages_in(block, order)) {
+						return true;
+					}
+				}
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * Returns the NUMA node that a page belongs to.
+	 * @param pgd The page descriptor of the page.
+	 */
+	unsigned int node_of(const PageDescriptor *pgd) const
+	{
+		uint64_t pfn = sys.mm().pgalloc().pgd_to_pfn(pgd);
+
+		unsigned int node = _nr_nodes - 1;
+		while (node > 0 && pfn < _node_start_pfn[node]) {
+			node--;
+		}
+
+		return node;
+	}
+
+	/**
+	 * Works out, for each node, the order in which the nodes should be tried when allocating: the
+	 * node itself first, then the others from nearest to furthest.
+	 */
+	void update_node_fallback()
+	{
+		for (unsigned int node = 0; node < _nr_nodes; node++) {
+			unsigned int *fallback = _node_fallback[node];
+
+			for (unsigned int i = 0; i < _nr_nodes; i++) {
+				fallback[i] = (node + i) % _nr_nodes;
+			}
+
+			// Insertion sort by distance, which keeps the node itself first, and ties in the
+			// order of node number after this one.
+			for (unsigned int i = 1; i < _nr_nodes; i++) {
+				unsigned int candidate = fallback[i];
+				unsigned int j = i;
+
+				while (j > 1 && _node_distance[node][fallback[j - 1]] > _node_distance[node][candidate]) {
+					fallback[j] = fallback[j - 1];
+					j--;
+				}
+
+				fallback[j] = candidate;
+			}
+		}
+	}
+
+	// The free areas of each NUMA node.
+	PageDescriptor *_free_areas[MAX_NODES][MAX_ORDER+1];
+
+	// How free blocks are reported to the hypervisor.
+	FreePageReporter _reporter;
+	void *_reporter_priv;
+
+	// One bit per reporting-order chunk of memory, set whilst the chunk is part of a reported free block.
+	uint64_t _reported[REPORTED_CHUNKS / 64];
+
+	// The number of pages in free blocks that are large enough to report, but have not been, and the
+	// total number of pages reported so far.
+	uint64_t _unreported_pages;
+	uint64_t _reported_pages;
+
+	// The number of NUMA nodes, where each one's memory starts, and how far apart they are.
+	unsigned int _nr_nodes;
+	uint64_t _node_start_pfn[MAX_NODES];
+	unsigned int _node_distance[MAX_NODES][MAX_NODES];
+
+	// For each node, the nodes to allocate from, nearest first.
+	unsigned int _node_fallback[MAX_NODES][MAX_NODES];
+
+	// The node each CPU belongs to.
+	unsigned int _cpu_node[MAX_CPUS];
+
+	// Per node: allocations that preferred the node and got it, and those that had to go elsewhere.
+	uint64_t _node_hits[MAX_NODES];
+	uint64_t _node_misses[MAX_NODES];
+
+	// Recently freed thread stacks, kept by each CPU for reuse, and how many there are altogether.
+	PageDescriptor *_stack_cache[MAX_CPUS][STACK_CACHE_MAX];
+	unsigned int _stack_cache_count[MAX_CPUS];
+	uint64_t _stack_cache_hits;
+	uint64_t _stack_cache_drains;
+	unsigned int _stack_cached;
+
+	// The memory being managed, how much of it is on the free lists, the point below which memory is
+	// running low, and the number of references each page has beyond its first (or NULL if no page has
+	// ever been shared).
+	uint64_t _base_pfn;
+	uint64_t _nr_pages;
+	uint64_t _nr_free_pages;
+	uint64_t _low_watermark;
+	uint16_t *_extra_refs;
+
+	// The shared zero page, the pages available for merging (hashed by contents, and one bit per page
+	// for whether it is in the table), and the next entry to consider evicting.
+	PageDescriptor *_zero_page;
+	MergeEntry *_merge_table;
+	uint64_t *_merge_candidates;
+	unsigned int _merge_table_used;
+	unsigned int _merge_evict_next;
+
+	// The number of pages offered for merging, how many were merged (into another page, or into the
+	// zero page), how many were evicted from the table, and the time spent doing so.
+	uint64_t _merge_scanned;
+	uint64_t _merged_pages;
+	uint64_t _merged_zero_pages;
+	uint64_t _merge_evictions;
+	uint64_t _merge_scan_time;
 };
 
+BuddyPageAllocator *BuddyPageAllocator::active;
+
+bool pgalloc_set_free_page_reporter(FreePageReporter reporter, void *priv)
+{
+	if (!BuddyPageAllocator::active) {
+		return false;
+	}
+
+	BuddyPageAllocator::active->set_free_page_reporter(reporter, priv);
+	return true;
+}
+
+uint64_t pgalloc_report_free_pages()
+{
+	return BuddyPageAllocator::active ? BuddyPageAllocator::active->report_free_pages() : 0;
+}
+
+PageDescriptor *pgalloc_alloc_pages_node(unsigned int node, int order)
+{
+	if (!BuddyPageAllocator::active) {
+		return nullptr;
+	}
+
+	// You must make sure that interrupts are
+	// disabled when manipulating the free lists.
+	UniqueIRQLock l;
+
+	return BuddyPageAllocator::active->alloc_pages_node(node, order);
+}
+
+PageDescriptor *pgalloc_alloc_stack()
+{
+	if (!BuddyPageAllocator::active) {
+		return nullptr;
+	}
+
+	UniqueIRQLock l;
+
+	return BuddyPageAllocator::active->alloc_stack();
+}
+
+bool pgalloc_free_stack(PageDescriptor *pgd)
+{
+	if (!BuddyPageAllocator::active) {
+		return false;
+	}
+
+	UniqueIRQLock l;
+
+	BuddyPageAllocator::active->free_stack(pgd);
+	return true;
+}
+
+bool pgalloc_get_page(PageDescriptor *pgd)
+{
+	if (!BuddyPageAllocator::active) {
+		return false;
+	}
+
+	UniqueIRQLock l;
+
+	return BuddyPageAllocator::active->get_page(pgd);
+}
+
+PageDescriptor *pgalloc_merge_page(PageDescriptor *pgd)
+{
+	if (!BuddyPageAllocator::active) {
+		return pgd;
+	}
+
+	UniqueIRQLock l;
+
+	return BuddyPageAllocator::active->merge_page(pgd);
+}
+
+bool pgalloc_merge_stats(PageMergeStats& stats)
+{
+	if (!BuddyPageAllocator::active) {
+		return false;
+	}
+
+	UniqueIRQLock l;
+
+	auto allocator = BuddyPageAllocator::active;
+	stats.scanned = allocator->merge_scanned_pages();
+	stats.merged = allocator->merged_pages();
+	stats.merged_zero = allocator->merged_zero_pages();
+	stats.evicted = allocator->merge_evictions();
+	stats.scan_time = allocator->merge_scan_time();
+
+	return true;
+}
+
 /* --- DO NOT CHANGE ANYTHING BELOW THIS LINE --- */
 
 /*
@@ -0,0 +1,79 @@
+/*
+ * Command-line Number Parsing
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#pragma once
+
+/**
+ * Parses the value of a numeric command-line option.
+ * @param value The value given on the command line.
+ * @param number Populated with the number, if the value was one.
+ * @return Returns TRUE if the value is a decimal number that fits in an unsigned int, or FALSE if it is
+ * empty, contains anything other than digits, or is too large.
+ */
+static inline bool parse_cmdline_number(const char *value, unsigned int& number)
+{
+	unsigned int result = 0;
+
+	if (!*value) {
+		return false;
+	}
+
+	for (const char *c = value; *c; c++) {
+		if (*c < '0' || *c > '9') {
+			return false;
+		}
+
+		unsigned int digit = *c - '0';
+		if (result > (~0u - digit) / 10) {
+			return false;
+		}
+
+		result = (result * 10) + digit;
+	}
+
+	number = result;
+	return true;
+}
+
+/**
+ * Parses the value of a command-line option that is a comma-separated list of numbers.
+ * @param value The value given on the command line.
+ * @param numbers Populated with the numbers in the list.
+ * @param max The most numbers the list may hold.
+ * @return Returns the number of numbers in the list, or zero if any of them is not a number (as
+ * parse_cmdline_number() sees it), or there are more than max of them.
+ */
+static inline unsigned int parse_cmdline_list(const char *value, unsigned int *numbers, unsigned int max)
+{
+	unsigned int count = 0;
+	char number[16];
+
+	for (;;) {
+		unsigned int length = 0;
+		while (value[length] && value[length] != ',') {
+			if (length == sizeof(number) - 1) {
+				return 0;
+			}
+
+			number[length] = value[length];
+			length++;
+		}
+
+		number[length] = 0;
+		if (count == max || !parse_cmdline_number(number, numbers[count])) {
+			return 0;
+		}
+
+		count++;
+
+		if (!value[length]) {
+			return count;
+		}
+
+		value += length + 1;
+	}
+}
@@ -7,190 +7,1050 @@
  * STUDENT NUMBER: s1620208
  */
 #include <infos/drivers/timer/rtc.h>
+#include <infos/drivers/irq/ioapic.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/irq.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/cmdline.h>
+#include <infos/kernel/log.h>
 #include <infos/util/lock.h>
 #include <arch/x86/pio.h>
+#include <arch/x86/context.h>
 
+#include "cmdline-number.h"
+#include "cpu.h"
+#include "irq-trace.h"
+#include "time-page.h"
+#include "timer-wheel.h"
+#include "tsc.h"
+
+// How often (in nanoseconds) the cached time is re-read from the RTC, to correct any drift between
+// the RTC and the kernel's monotonic clock.
+#define RTC_RESYNC_INTERVAL	60000000000ULL
+
+#define NANOSECONDS_PER_SECOND	1000000000ULL
+
+// The ISA IRQ line the RTC interrupts on.
+#define RTC_IRQ			8
+
+// Status register A: update in progress.
+#define RTC_A_UIP		0x80
+
+// Status register A: periodic interrupt rate selector.
+#define RTC_A_RATE_MASK		0x0F
+
+// Status register B: 24-hour mode, binary (rather than BCD) mode, update-ended interrupt enable and
+// periodic interrupt enable.
+#define RTC_B_24HOUR		0x02
+#define RTC_B_BINARY		0x04
+#define RTC_B_UIE		0x10
+#define RTC_B_AIE		0x20
+#define RTC_B_PIE		0x40
+
+// Status register C: update-ended, alarm and periodic interrupt flags.
+#define RTC_C_UF		0x10
+#define RTC_C_AF		0x20
+#define RTC_C_PF		0x40
+
+// The furthest ahead (in seconds) the alarm can be set, as it only matches on the time of day.
+#define RTC_ALARM_MAX_DELAY	86399
+
+// The number of profiling samples each of a CPU's two profile buffers holds.
+#define PROFILE_BUFFER_SIZE	256
+
+// How often (in nanoseconds) the profile and IRQs-off trace are written out, if nothing fills a
+// profile buffer sooner.
+#define PROFILE_DUMP_INTERVAL	10000000000ULL
+
+// The century register, as found on every PC-compatible RTC since the PS/2.
+#define RTC_CENTURY_REGISTER	0x32
+
+// The shortest time (in nanoseconds) the TSC frequency is measured over, to keep the error down.
+#define TSC_MEASURE_TIME	1000000000ULL
+
+using namespace infos::kernel;
 using namespace infos::drivers;
+using namespace infos::drivers::irq;
 using namespace infos::drivers::timer;
 using namespace infos::util;
 using namespace infos::arch::x86;
 
+/*
+ * The page through which processes read the time without a system call.  It is rewritten every
+ * time the cached RTC time is.
+ */
+TimePage time_page;
+
+// The periodic interrupt rate selector to profile with, or zero if profiling is disabled.
+static unsigned int profile_rate;
+
+/*
+ * rtc.profile=<hz> samples the running code at the given frequency, which must be a power of two
+ * between 2 and 8192.  The samples come from the RTC's periodic interrupt, so only the CPU that
+ * IRQ 8 is routed to is sampled.  They are written to the log by the next thread to read the time
+ * once a buffer fills, or every PROFILE_DUMP_INTERVAL otherwise.
+ */
+RegisterCmdLineArgument(RTCProfile, "rtc.profile")
+{
+	unsigned int hz;
+	if (!parse_cmdline_number(value, hz)) {
+		hz = 0;
+	}
+
+	// The periodic interrupt runs at 32768 >> (rate - 1) Hz, for rates 3 to 15.
+	profile_rate = 0;
+	for (unsigned int rate = 3; rate <= 15; rate++) {
+		if ((32768u >> (rate - 1)) == hz) {
+			profile_rate = rate;
+		}
+	}
+
+	if (!profile_rate) {
+		syslog.messagef(LogLevel::WARNING, "rtc.profile: %s Hz not supported (a power of two from 2 to 8192)", value);
+	}
+}
+
+// Whether to log how long the kernel took to boot.
+static bool boot_marker;
+
+/*
+ * rtc.boot-marker=1 logs "BENCH boot-time <ns> ns", with the kernel's runtime, the first time a
+ * thread reads the time.  Each of task/bench-matrix.sh's benchmark programs reads the time as soon
+ * as it starts, so this is how long the kernel took to boot and start it.
+ */
+RegisterCmdLineArgument(RTCBootMarker, "rtc.boot-marker")
+{
+	boot_marker = value[0] == '1';
+}
+
 class CMOSRTC : public RTC {
 public:
 	static const DeviceClass CMOSRTCDeviceClass;
 
+	/**
+	 * A raw copy of the status, date & time registers of the RTC, all taken in one pass.  Status
+	 * register C is left alone, as reading it acknowledges the interrupt flags, and only the interrupt
+	 * handler may do that.
+	 */
+	struct CMOSSnapshot
+	{
+		uint8_t status_a;
+		uint8_t status_b;
+
+		uint8_t seconds;
+		uint8_t minutes;
+		uint8_t hours;
+		uint8_t day_of_month;
+		uint8_t month;
+		uint8_t year;
+		uint8_t century;
+	};
+
 	const DeviceClass& device_class() const override
 	{
 		return CMOSRTCDeviceClass;
 	}
 
+	CMOSRTC() : _base_seq(0), _base_century(0), _base_runtime(0), _base_valid(false), _floor_century(0), _has_floor(false), _updating(false), _irq_driven(false), _measure_tsc(0), _measure_runtime(0), _tsc_frequency(0), _port_io_count(0), _alarm_expiry(TIMER_WHEEL_NONE), _resync_timer(resync_timer_expired, this), _profile_dumping(false), _dump_pending(false), _next_dump(PROFILE_DUMP_INTERVAL), _boot_marked(false) { }
+
 	/**
-	 * Interrogates the RTC to read the current date & time.
+	 * Initialises the RTC, enabling the update-ended interrupt so that the cached time is first
+	 * read straight after an RTC update.  After that, the interrupt is only turned back on once
+	 * every RTC_RESYNC_INTERVAL, to correct for drift.  If the interrupt cannot be routed, the
+	 * cached time is instead refreshed by polling, every RTC_RESYNC_INTERVAL.  If profiling
+	 * was asked for on the command line, the periodic interrupt is enabled too.
+	 *
+	 * This never reads the time, so it does not wait for the RTC: the time is first read by the
+	 * first update-ended interrupt, or by the first caller of read_timepoint(), whichever
+	 * comes first.
+	 * @return Returns TRUE, as the RTC is usable either way.
+	 */
+	bool init(DeviceManager& dm) override
+	{
+		// Start measuring the TSC frequency, so that it is known by the time the time page is first
+		// written, unless that happens less than TSC_MEASURE_TIME after boot.
+		_measure_tsc = read_tsc();
+		_measure_runtime = sys.runtime();
+
+		IOAPIC *ioapic;
+		if (!dm.try_get_device_by_class(IOAPIC::IOAPICDeviceClass, ioapic)) {
+			return true;
+		}
+
+		IRQ *irq = ioapic->request_physical_irq(RTC_IRQ);
+		if (!irq) {
+			return true;
+		}
+
+		irq->attach(rtc_irq_handler, this);
+
+		{
+			// You must make sure that interrupts are
+			// disabled when accessing the RTC
+			TracedIRQLock l(IRQ_TRACE_SITE());
+
+			uint8_t status_b = get_cmos_register(0xB) | RTC_B_UIE;
+
+			if (profile_rate) {
+				set_cmos_register(0xA, (get_cmos_register(0xA) & ~RTC_A_RATE_MASK) | profile_rate);
+				status_b |= RTC_B_PIE;
+			}
+
+			set_cmos_register(0xB, status_b);
+
+			// Reading status register C acknowledges anything already pending.
+			get_cmos_register(0xC);
+		}
+
+		_irq_driven = true;
+		irq->enable();
+
+		return true;
+	}
+
+	/**
+	 * Works out the current date & time, from a copy of the RTC taken earlier plus the time
+	 * that has passed on the kernel's monotonic clock since.  The copy is refreshed by the
+	 * update-ended interrupt every RTC_RESYNC_INTERVAL, so this is normally just a copy of the
+	 * cached value; without the interrupt, the RTC is interrogated the first time, and then
+	 * every RTC_RESYNC_INTERVAL to correct for drift.  The periodic re-read never waits: if the RTC is mid-update, or
+	 * another caller is already re-reading it, the existing copy is used.
+	 *
+	 * Whilst profiling or tracing, this is also where the samples are written out, as it is called
+	 * from threads, and regularly.  The boot marker is logged from here too, if it was asked for.
 	 * @param current Populates the given structure with the current
 	 * data & time, as given by the CMOS RTC device.
 	 */
 	void read_timepoint(RTCTimePoint& current) override
 	{
-		current = get_timepoint();
-		RTCTimePoint previous = current;
-
-		// Keep reading timepoints (from registers) until we get two values in a row.
-		// This avoids getting dodgy/inconsistent values due to RTC updates.
-		do {
-			previous = current;
-			current = get_timepoint();
-		} while (!tp_eq(current, previous));
-
-		if (is_bcd_mode()) {
-			convert_tp_from_bcd(current);
+		if ((profile_rate || irq_trace_enabled) && interrupts_enabled() &&
+				(__atomic_load_n(&_dump_pending, __ATOMIC_RELAXED) || sys.runtime() >= _next_dump)) {
+			dump_profile();
 		}
 
-		// If we are in 12hr mode, and the PM bit is set
-		if (is_12hr_mode() && (current.hours & 0x80)) {
-			// Mask off the PM bit, add 12, and apply sanity check
-			// Note: Midnight in 12hr mode is `12`, not `0`
-			current.hours = ((current.hours & 0x7F) + 12) % 24;
+		if (boot_marker && interrupts_enabled() && !__atomic_exchange_n(&_boot_marked, true, __ATOMIC_RELAXED)) {
+			syslog.messagef(LogLevel::INFO, "BENCH boot-time %lu ns", sys.runtime());
 		}
+
+		read_time(current);
 	}
 
 	/**
-	 * Converts a timepoint from BCD to binary values
-	 * @param tp The timepoint to convert
+	 * Interrogates the RTC to read the current date & time.
+	 * @warning THIS IS EXTREMELY EXPENSIVE. It performs port I/O, and may wait for an RTC update to finish.
+	 * @param current Populates the given structure with the current
+	 * data & time, as given by the CMOS RTC device.
 	 */
-	void convert_tp_from_bcd(RTCTimePoint& tp)
+	void read_rtc(RTCTimePoint& current)
 	{
-		tp.seconds = from_bcd(tp.seconds);
-		tp.minutes = from_bcd(tp.minutes);
-		// Below line from https://wiki.osdev.org/CMOS#Examples
-		// tp.hours = ( (tp.hours & 0xF) + (((tp.hours & 0x70) / 16) * 10) ) | (tp.hours & 0x80);
-		tp.hours = from_bcd(tp.hours);
-		tp.day_of_month = from_bcd(tp.day_of_month);
-		tp.month = from_bcd(tp.month);
-		tp.year = from_bcd(tp.year);
+		decode_snapshot(take_snapshot(), current);
 	}
 
 	/**
-	 * Reads the CMOS to determine if we are in BCD mode
-	 * @returns true if we are in BCD mode
+	 * Starts a coarse (one-second resolution) timer, for long sleeps and timeouts.  The timer's
+	 * callback always runs from the RTC interrupt handler, never from here, even if it is
+	 * already due.  The RTC alarm is set for the earliest pending timer, so no periodic tick is
+	 * needed whilst timers are waiting.
+	 * @param timer The timer to start.
+	 * @param seconds How many seconds from now the timer should expire.
+	 * @return Returns TRUE if the timer was started, or FALSE if the RTC interrupt is not available.
 	 */
-	bool is_bcd_mode()
+	bool add_timer(CoarseTimer& timer, uint64_t seconds)
 	{
+		if (!_irq_driven) {
+			return false;
+		}
+
 		// You must make sure that interrupts are
 		// disabled when accessing the RTC
-		UniqueIRQLock l;
+		TracedIRQLock l(IRQ_TRACE_SITE());
+
+		start_timer(timer, seconds);
+		return true;
+	}
+
+	/**
+	 * Stops a coarse timer, if it is pending.  The alarm is left as it is: if it goes off with
+	 * nothing due, it is simply set again for the next pending timer.
+	 * @param timer The timer to stop.
+	 */
+	void cancel_timer(CoarseTimer& timer)
+	{
+		TracedIRQLock l(IRQ_TRACE_SITE());
+
+		_timers.cancel(timer);
+	}
+
+	/**
+	 * Writes out the profiling samples taken so far to the system log, in the format that
+	 * task/profile-symbolise.sh expects, including any partly filled buffers.  Each CPU carries on
+	 * sampling into its other buffer whilst this is going on, so interrupts are only disabled to
+	 * swap the buffers over.  If samples arrive faster than they are written out, the excess is
+	 * counted and reported as dropped.  The IRQs-off trace is written out too, if it is enabled,
+	 * so that one dump covers both.  read_timepoint() calls this whenever a buffer fills, and every
+	 * PROFILE_DUMP_INTERVAL.
+	 * @warning Writing to the log is slow, so this must not be called from an interrupt handler.
+	 */
+	void dump_profile()
+	{
+		// Only one dump at a time, as the buffer each CPU is swapped to must have been emptied.
+		if (__atomic_exchange_n(&_profile_dumping, true, __ATOMIC_ACQUIRE)) {
+			return;
+		}
+
+		__atomic_store_n(&_dump_pending, false, __ATOMIC_RELAXED);
+		_next_dump = sys.runtime() + PROFILE_DUMP_INTERVAL;
+
+		for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+			ProfileBuffer *buffer;
+
+			{
+				TracedIRQLock l(IRQ_TRACE_SITE());
+
+				buffer = &_profile[cpu][_profile_recording[cpu]];
+				_profile_recording[cpu] ^= 1;
+			}
+
+			for (unsigned int i = 0; i < buffer->count; i++) {
+				syslog.messagef(LogLevel::INFO, "PROF %u %p %lx", cpu, buffer->samples[i].thread, buffer->samples[i].rip);
+			}
+
+			if (buffer->dropped) {
+				syslog.messagef(LogLevel::INFO, "PROF-DROPPED %u %lu", cpu, buffer->dropped);
+			}
+
+			buffer->count = 0;
+			buffer->dropped = 0;
+		}
 
-		// Read bit 2 from status register B
-		auto bit = get_cmos_register(0xB, 2);
+		irq_trace_dump();
 
-		// The bit is zero if register values are in binary coded decimal
-		return bit == 0;
+		__atomic_store_n(&_profile_dumping, false, __ATOMIC_RELEASE);
 	}
 
 	/**
-	 * Reads the CMOS to determine if we are in 12hr mode
-	 * @returns true if we are in 12hr mode
+	 * Returns the number of port I/O operations the driver has performed, so that the cost of
+	 * reading the time can be measured.
+	 */
+	uint64_t port_io_count() const { return _port_io_count; }
+
+	/**
+	 * Reads status registers A and B, every date & time register and the century register.
+	 * If an update is in progress, this waits for it to finish first.  An update can take up to
+	 * 2ms, so interrupts are only disabled for each poll of the update-in-progress bit, and for
+	 * the final pass over the registers.  Once the bit has been seen clear, the RTC guarantees
+	 * no update will start for at least 244us, which is ample time to read the remaining
+	 * registers, so they are consistent without having to read them all again.
+	 * @return The snapshot of the registers.
 	 */
-	bool is_12hr_mode()
+	CMOSSnapshot take_snapshot()
+	{
+		CMOSSnapshot snapshot;
+
+		// Wait for current update to complete
+		while (!try_take_snapshot(snapshot)) {
+			// nop
+		}
+
+		return snapshot;
+	}
+
+	/**
+	 * Takes a snapshot of the registers, as take_snapshot() does, unless an update is in progress.
+	 * @param snapshot Populated with the snapshot of the registers.
+	 * @return Returns TRUE if the snapshot was taken, or FALSE if an update was in progress.
+	 */
+	bool try_take_snapshot(CMOSSnapshot& snapshot)
 	{
 		// You must make sure that interrupts are
 		// disabled when accessing the RTC
-		UniqueIRQLock l;
+		TracedIRQLock l(IRQ_TRACE_SITE());
+
+		snapshot.status_a = get_cmos_register(0xA);
+		if (snapshot.status_a & RTC_A_UIP) {
+			return false;
+		}
+
+		snapshot.status_b = get_cmos_register(0xB);
+
+		snapshot.seconds = get_cmos_register(0x00);
+		snapshot.minutes = get_cmos_register(0x02);
+		snapshot.hours = get_cmos_register(0x04);
+		snapshot.day_of_month = get_cmos_register(0x07);
+		snapshot.month = get_cmos_register(0x08);
+		snapshot.year = get_cmos_register(0x09);
+		snapshot.century = get_cmos_register(RTC_CENTURY_REGISTER);
+
+		return true;
+	}
+
+	/**
+	 * Converts a snapshot of the registers into a binary, 24-hour timepoint, using the modes
+	 * given in the snapshot's copy of status register B.
+	 * @param snapshot The snapshot to decode.
+	 * @param tp Populated with the decoded timepoint.
+	 */
+	void decode_snapshot(const CMOSSnapshot& snapshot, RTCTimePoint& tp)
+	{
+		bool bcd_mode = !(snapshot.status_b & RTC_B_BINARY);
+		bool twelve_hour_mode = !(snapshot.status_b & RTC_B_24HOUR);
 
-		// Read bit 1 from status register B
-		auto bit = get_cmos_register(0xB, 2);
+		// In 12-hour mode, the top bit of the hours register is the PM flag, and must be
+		// masked off before the hours are decoded.
+		bool pm = twelve_hour_mode && (snapshot.hours & 0x80);
+		uint8_t hours = twelve_hour_mode ? (snapshot.hours & 0x7F) : snapshot.hours;
+
+		tp.seconds = snapshot.seconds;
+		tp.minutes = snapshot.minutes;
+		tp.hours = hours;
+		tp.day_of_month = snapshot.day_of_month;
+		tp.month = snapshot.month;
+		tp.year = snapshot.year;
+
+		if (bcd_mode) {
+			tp.seconds = from_bcd(tp.seconds);
+			tp.minutes = from_bcd(tp.minutes);
+			tp.hours = from_bcd(tp.hours);
+			tp.day_of_month = from_bcd(tp.day_of_month);
+			tp.month = from_bcd(tp.month);
+			tp.year = from_bcd(tp.year);
+		}
 
-		// The bit is zero if we are in 12hr mode
-		return bit == 0;
+		// Note: Midnight in 12hr mode is `12 AM`, and noon is `12 PM`
+		if (twelve_hour_mode) {
+			tp.hours = (tp.hours % 12) + (pm ? 12 : 0);
+		}
 	}
 
+	/**
+	 * Decodes the century register in a snapshot.  The year in a timepoint is always the last two
+	 * digits, just like the RTC's own year register, so the century is kept separately.
+	 * @param snapshot The snapshot to decode.
+	 * @return The century (e.g. 20 for the 2000s), or zero if the RTC does not seem to implement the
+	 * century register.
+	 */
+	unsigned int decode_century(const CMOSSnapshot& snapshot)
+	{
+		unsigned int century = snapshot.century;
+		if (!(snapshot.status_b & RTC_B_BINARY)) {
+			century = from_bcd(century);
+		}
+
+		// Only trust the century register if it holds a plausible century.
+		return (century >= 19 && century <= 21) ? century : 0;
+	}
+
+	/**
+	 * Returns the century that goes with the two-digit year of the cached time, or zero if the RTC
+	 * does not implement the century register.  Just after the year wraps around from 99, this may
+	 * still give the old century, until the cached time is next refreshed from the RTC.
+	 */
+	unsigned int century() const { return _base_century; }
+
 private:
 	int const CMOS_ADDRESS = 0x70;
 	int const CMOS_DATA = 0x71;
 
+	// The date & time last read from the RTC, and the kernel runtime at which it was read.  These
+	// are protected by a sequence counter, which is odd whilst they are being updated.
+	volatile uint64_t _base_seq;
+	RTCTimePoint _base;
+	unsigned int _base_century;
+	uint64_t _base_runtime;
+	volatile bool _base_valid;
+
+	// The time given out just before the base last went backwards, which the time is held at until
+	// the RTC catches up.  These are protected by the same sequence counter as the base.
+	RTCTimePoint _floor;
+	unsigned int _floor_century;
+	bool _has_floor;
+
+	// Set whilst the base is being updated, so that only one writer (a resync, or the interrupt
+	// handler) touches it at a time.
+	bool _updating;
+
+	// Whether the base is being kept up to date by the update-ended interrupt.
+	bool _irq_driven;
+
+	// The TSC value and kernel runtime the TSC frequency is being measured from, and the frequency
+	// last measured.
+	uint64_t _measure_tsc;
+	uint64_t _measure_runtime;
+	uint64_t _tsc_frequency;
+
+	// The number of port I/O operations performed.  All port I/O goes through get_cmos_register()
+	// and set_cmos_register(), which keeps this accurate.
+	uint64_t _port_io_count;
+
+	// Coarse timers, on a clock of whole seconds of kernel runtime, and the time the alarm is set for.
+	TimerWheel _timers;
+	uint64_t _alarm_expiry;
+
+	// Turns the update-ended interrupt back on, every RTC_RESYNC_INTERVAL.
+	CoarseTimer _resync_timer;
+
 	/**
-	 * Reads a specific register from the CMOS
+	 * Works out the current date & time, as read_timepoint() does, but without ever writing out the
+	 * profile, so that it can be used from the interrupt handler.
+	 * @param current Populates the given structure with the current date & time.
+	 */
+	void read_time(RTCTimePoint& current)
+	{
+		uint64_t now = sys.runtime();
+
+		if (!_base_valid) {
+			// There is no copy to fall back on.  If somebody else is already making the first one,
+			// read the RTC directly rather than wait for them to finish.
+			if (!resync(true)) {
+				read_rtc(current);
+				return;
+			}
+		} else if (!_irq_driven && ((now - _base_runtime) >= RTC_RESYNC_INTERVAL ||
+				(!_tsc_frequency && (now - _measure_runtime) >= TSC_MEASURE_TIME))) {
+			// Resync early, the once, if the time page can now be given the TSC frequency.
+			resync(false);
+		}
+
+		uint64_t base_runtime;
+		unsigned int century, floor_century;
+		RTCTimePoint floor;
+		bool has_floor;
+		read_base(current, century, base_runtime, floor, floor_century, has_floor);
+
+		now = sys.runtime();
+		if (now > base_runtime) {
+			advance_timepoint(current, (now - base_runtime) / NANOSECONDS_PER_SECOND);
+		}
+
+		// The RTC was behind the time already given out when it was last read, so hold the time
+		// there until the RTC catches up.
+		if (has_floor && earlier(current, century, floor, floor_century)) {
+			current = floor;
+		}
+	}
+
+	/**
+	 * Starts a coarse timer, and moves the alarm if the timer is due before it.
 	 * @warning Does not ensure interrupts are disabled. Use with care.
-	 * @param reg The register to read
-	 * @return The data at the given register
+	 * @param timer The timer to start.
+	 * @param seconds How many seconds from now the timer should expire.
 	 */
-	uint8_t get_cmos_register(int reg)
+	void start_timer(CoarseTimer& timer, uint64_t seconds)
 	{
-		__outb(CMOS_ADDRESS, reg); // activate the register
-		return __inb(CMOS_DATA);
+		uint64_t now = sys.runtime() / NANOSECONDS_PER_SECOND;
+
+		// The wheel's clock is only moved on by the interrupt handler whilst timers are pending.  With
+		// none pending, it can be brought up to date here, as there are no callbacks to run.
+		if (_timers.count() == 0) {
+			_timers.advance(now);
+		}
+
+		_timers.add(timer, now + seconds);
+
+		// Only an earlier expiry needs the alarm moving.
+		if (now + seconds < _alarm_expiry) {
+			program_alarm(now + seconds, now);
+		}
+	}
+
+	/**
+	 * Turns the update-ended interrupt back on, so that the cached time is refreshed after the next
+	 * RTC update.
+	 * @warning Must be called from the RTC interrupt handler.
+	 */
+	static void resync_timer_expired(CoarseTimer *timer, void *priv)
+	{
+		auto rtc = (CMOSRTC *)priv;
+		rtc->set_cmos_register(0xB, rtc->get_cmos_register(0xB) | RTC_B_UIE);
 	}
 
 	/**
-	 * Reads a specific bit from a specific register from the CMOS
+	 * Runs any coarse timers that have expired, and sets the alarm for the next one if the alarm
+	 * has gone off.
 	 * @warning Does not ensure interrupts are disabled. Use with care.
-	 * @warning This reads the entire register as well, so is not suitable for batch operations.
-	 * @param reg The register to read
-	 * @param bit The nth bit to read
-	 * @return The nth bit at the given register
+	 * @param alarm Whether the alarm has just gone off.
 	 */
-	uint8_t get_cmos_register(int reg, int bit)
+	void run_timers(bool alarm)
 	{
-		return (get_cmos_register(reg) >> bit) & 1;
+		uint64_t now = sys.runtime() / NANOSECONDS_PER_SECOND;
+		_timers.advance(now);
+
+		if (!alarm && now < _alarm_expiry) {
+			return;
+		}
+
+		_alarm_expiry = TIMER_WHEEL_NONE;
+
+		uint64_t next = _timers.next_expiry();
+		if (next != TIMER_WHEEL_NONE) {
+			program_alarm(next, now);
+		} else {
+			set_cmos_register(0xB, get_cmos_register(0xB) & ~RTC_B_AIE);
+		}
 	}
 
 	/**
-	 * Reads the CMOS to determine if an RTC update is in progress
+	 * Sets the RTC alarm to go off at the given time, or as close to it as the alarm can reach.
 	 * @warning Does not ensure interrupts are disabled. Use with care.
-	 * @return true if time update in progress, false otherwise (date and time is safe to be read)
+	 * @param expiry When the alarm should go off, in seconds of kernel runtime.
+	 * @param now The current time, in seconds of kernel runtime.
+	 */
+	void program_alarm(uint64_t expiry, uint64_t now)
+	{
+		uint64_t delay = expiry > now ? expiry - now : 1;
+		if (delay > RTC_ALARM_MAX_DELAY) {
+			delay = RTC_ALARM_MAX_DELAY;
+		}
+
+		RTCTimePoint alarm;
+		read_time(alarm);
+		advance_timepoint(alarm, delay);
+
+		// The alarm registers are in the same format as the time registers.
+		uint8_t status_b = get_cmos_register(0xB);
+		bool bcd_mode = !(status_b & RTC_B_BINARY);
+		bool twelve_hour_mode = !(status_b & RTC_B_24HOUR);
+
+		uint8_t hours = alarm.hours;
+		if (twelve_hour_mode) {
+			hours = alarm.hours % 12 ? alarm.hours % 12 : 12;
+		}
+
+		uint8_t seconds = bcd_mode ? to_bcd(alarm.seconds) : alarm.seconds;
+		uint8_t minutes = bcd_mode ? to_bcd(alarm.minutes) : alarm.minutes;
+		hours = bcd_mode ? to_bcd(hours) : hours;
+
+		if (twelve_hour_mode && alarm.hours >= 12) {
+			hours |= 0x80;
+		}
+
+		set_cmos_register(0x01, seconds);
+		set_cmos_register(0x03, minutes);
+		set_cmos_register(0x05, hours);
+		set_cmos_register(0xB, status_b | RTC_B_AIE);
+
+		_alarm_expiry = now + delay;
+	}
+
+	/**
+	 * Re-reads the RTC, and makes the result the new base for working out the current time.
+	 * This never waits for somebody else who is updating the base.
+	 * @param wait Whether to wait for an RTC update in progress to finish, rather than give up.
+	 * @return Returns TRUE if the RTC was read, or FALSE if somebody else was already updating the
+	 * base, or the RTC was mid-update (and wait was FALSE).
 	 */
-	bool is_update_in_progress()
+	bool resync(bool wait)
 	{
-		// Note: @returns text has been plucked from http://www.bioscentral.com/misc/cmosmap.htm
+		if (__atomic_exchange_n(&_updating, true, __ATOMIC_ACQUIRE)) {
+			return false;
+		}
+
+		CMOSSnapshot snapshot;
+		if (wait) {
+			snapshot = take_snapshot();
+		} else if (!try_take_snapshot(snapshot)) {
+			__atomic_store_n(&_updating, false, __ATOMIC_RELEASE);
+			return false;
+		}
 
-		// Read bit 7 from status register A
-		auto bit = get_cmos_register(0xA, 7);
+		RTCTimePoint tp;
+		decode_snapshot(snapshot, tp);
 
-		// The bit is non-zero if an update is in progress
-		return bit != 0;
+		publish_base(tp, decode_century(snapshot), sys.runtime());
+		return true;
 	}
 
 	/**
-	 * Reads a timepoint straight from the RTC.
-	 * If an RTC update is currently in progress, it will block until the update has completed.
-	 * @warning THIS IS EXTREMELY EXPENSIVE AND UNSAFE.
-	 * @return The timepoint composed from several register reads
+	 * Replaces the base timepoint, and releases the right to update it.  The new base is always
+	 * taken, so that a kernel clock that runs fast of the RTC is corrected.  The time must never go
+	 * backwards though, so if the new base is behind the time the old base already gives, that time
+	 * becomes a floor, which the time is held at until the RTC catches up.
+	 * @warning The caller must have set _updating.
+	 * @param tp The new base timepoint.
+	 * @param century The century of the new base timepoint, or zero if it is not known.
+	 * @param runtime The kernel runtime at which the timepoint was read.
 	 */
-	RTCTimePoint get_timepoint()
+	void publish_base(const RTCTimePoint& tp, unsigned int century, uint64_t runtime)
 	{
-		// You must make sure that interrupts are
-		// disabled when accessing the RTC
-		UniqueIRQLock l;
+		RTCTimePoint floor;
+		unsigned int floor_century = 0;
+		bool has_floor = false;
 
-		// Wait for current update to complete
-		while (is_update_in_progress()) {
-			// nop
+		if (_base_valid) {
+			floor = _base;
+			floor_century = _base_century;
+
+			if (runtime > _base_runtime) {
+				advance_timepoint(floor, (runtime - _base_runtime) / NANOSECONDS_PER_SECOND);
+			}
+
+			// The time may already be held at an earlier floor, which is later still.
+			if (_has_floor && earlier(floor, floor_century, _floor, _floor_century)) {
+				floor = _floor;
+				floor_century = _floor_century;
+			}
+
+			has_floor = earlier(tp, century, floor, floor_century);
+		}
+
+		_base_seq++;
+		__sync_synchronize();
+
+		_base = tp;
+		_base_century = century;
+		_base_runtime = runtime;
+		_floor = floor;
+		_floor_century = floor_century;
+		_has_floor = has_floor;
+
+		__sync_synchronize();
+		_base_seq++;
+
+		_base_valid = true;
+
+		uint64_t tsc = read_tsc();
+		measure_tsc_frequency(tsc, runtime);
+
+		update_time_page(tp, century, runtime, tsc, has_floor ? epoch_seconds(floor, floor_century) : 0);
+
+		__atomic_store_n(&_updating, false, __ATOMIC_RELEASE);
+	}
+
+	/**
+	 * Measures the TSC frequency against the kernel's monotonic clock, over the time since it was last
+	 * measured.  This needs nothing from the RTC, so works whether or not the RTC interrupt is available.
+	 * @warning The caller must have set _updating.
+	 * @param tsc The current TSC value.
+	 * @param runtime The kernel runtime at which the TSC was read.
+	 */
+	void measure_tsc_frequency(uint64_t tsc, uint64_t runtime)
+	{
+		if (runtime - _measure_runtime < TSC_MEASURE_TIME) {
+			return;
+		}
+
+		// Divide by milliseconds first, so that nothing overflows however long the measurement took.
+		uint64_t ticks = tsc - _measure_tsc;
+		uint64_t milliseconds = (runtime - _measure_runtime) / 1000000;
+
+		_tsc_frequency = ((ticks / milliseconds) * 1000) + (((ticks % milliseconds) * 1000) / milliseconds);
+
+		_measure_tsc = tsc;
+		_measure_runtime = runtime;
+	}
+
+	/**
+	 * Rewrites the shared time page with a new base.
+	 * @warning The caller must have set _updating.
+	 * @param tp The new base timepoint.
+	 * @param century The century of the new base timepoint, or zero if it is not known.
+	 * @param runtime The kernel runtime at which the timepoint was read.
+	 * @param tsc The TSC value at which the timepoint was read.
+	 * @param floor_seconds The time the wall-clock time is held at until the RTC catches up, in seconds
+	 * since the UNIX epoch, or zero if it is not being held.
+	 */
+	void update_time_page(const RTCTimePoint& tp, unsigned int century, uint64_t runtime, uint64_t tsc, uint64_t floor_seconds)
+	{
+		time_page.sequence++;
+		__sync_synchronize();
+
+		time_page.base_wall_seconds = epoch_seconds(tp, century);
+		time_page.floor_wall_seconds = floor_seconds;
+		time_page.base_runtime = runtime;
+		time_page.base_tsc = tsc;
+		time_page.tsc_frequency = _tsc_frequency;
+
+		__sync_synchronize();
+		time_page.sequence++;
+	}
+
+	/**
+	 * Converts a timepoint into the number of seconds since the UNIX epoch.
+	 * @param tp The timepoint to convert.
+	 * @param century The century of the timepoint, or zero to take it to be in the 2000s.
+	 */
+	static uint64_t epoch_seconds(const RTCTimePoint& tp, unsigned int century)
+	{
+		unsigned int year = (century ? century * 100 : 2000) + tp.year;
+		uint64_t days = 0;
+
+		for (unsigned int y = 1970; y < year; y++) {
+			days += is_leap_year(y) ? 366 : 365;
+		}
+
+		for (unsigned int m = 1; m < tp.month; m++) {
+			days += days_in_month(m, year);
+		}
+
+		days += tp.day_of_month - 1;
+
+		return (((days * 24) + tp.hours) * 60 + tp.minutes) * 60 + tp.seconds;
+	}
+
+	/**
+	 * Handles an interrupt from the RTC.
+	 */
+	static void rtc_irq_handler(const IRQ *irq, void *priv)
+	{
+		((CMOSRTC *)priv)->handle_interrupt();
+	}
+
+	/**
+	 * Handles the periodic interrupt, the alarm, and the update-ended interrupt.  After an RTC
+	 * update, the base timepoint is refreshed: the registers will not change again for almost a
+	 * second, so they can be read straight away, without waiting or re-reading.  The update-ended
+	 * interrupt is then turned off until the resync timer turns it back on, so that the RTC only
+	 * interrupts once every RTC_RESYNC_INTERVAL when nothing else is going on.
+	 */
+	void handle_interrupt()
+	{
+		// Reading status register C acknowledges the interrupt, and says why it was raised.
+		uint8_t flags = get_cmos_register(0xC);
+
+		if (flags & RTC_C_PF) {
+			record_profile_sample();
+		}
+
+		// The update-ended interrupt also runs the timers, in case the alarm raced with an RTC update.
+		if (flags & (RTC_C_AF | RTC_C_UF)) {
+			run_timers(flags & RTC_C_AF);
+		}
+
+		if (!(flags & RTC_C_UF)) {
+			return;
+		}
+
+		auto snapshot = take_snapshot();
+
+		// If a resync is already in progress, it will publish a fresh base itself.
+		if (!__atomic_exchange_n(&_updating, true, __ATOMIC_ACQUIRE)) {
+			RTCTimePoint tp;
+			decode_snapshot(snapshot, tp);
+
+			publish_base(tp, decode_century(snapshot), sys.runtime());
+		}
+
+		// The first update normally comes before the TSC frequency can be measured, so the interrupt
+		// is left on until it has been, and the time page has been republished with it.
+		if (!_tsc_frequency) {
+			return;
+		}
+
+		set_cmos_register(0xB, get_cmos_register(0xB) & ~RTC_B_UIE);
+		start_timer(_resync_timer, RTC_RESYNC_INTERVAL / NANOSECONDS_PER_SECOND);
+	}
+
+	/**
+	 * A profiling sample: what was running when the periodic interrupt fired.
+	 */
+	struct ProfileSample
+	{
+		uint64_t rip;
+		Thread *thread;
+	};
+
+	/**
+	 * Profiling samples taken on one CPU.
+	 */
+	struct ProfileBuffer
+	{
+		ProfileSample samples[PROFILE_BUFFER_SIZE];
+		unsigned int count;
+		uint64_t dropped;
+	};
+
+	// Each CPU records samples into one of its two buffers, whilst the other is written out.
+	ProfileBuffer _profile[MAX_CPUS][2];
+	unsigned int _profile_recording[MAX_CPUS];
+
+	// Set whilst the profile is being written out.
+	bool _profile_dumping;
+
+	// Set when a profile buffer has filled, so that the next read of the time writes the profile out
+	// rather than dropping samples, and the time the profile is next written out regardless.
+	bool _dump_pending;
+	uint64_t _next_dump;
+
+	// Set once the boot marker has been logged.
+	bool _boot_marked;
+
+	/**
+	 * Records the interrupted instruction pointer and thread, in this CPU's profile buffer.
+	 * @warning Must be called from the RTC interrupt handler.
+	 */
+	void record_profile_sample()
+	{
+		unsigned int cpu = current_cpu() % MAX_CPUS;
+		auto& buffer = _profile[cpu][_profile_recording[cpu]];
+
+		// Samples are dropped (but counted) until the buffer has been written out.
+		if (buffer.count == PROFILE_BUFFER_SIZE) {
+			buffer.dropped++;
+			return;
+		}
+
+		// The interrupted register state is saved in the current thread's context.
+		auto& thread = (Thread&)sys.scheduler().current_entity();
+		auto context = (X86Context *)thread.context().native_context;
+
+		auto& sample = buffer.samples[buffer.count++];
+		sample.rip = context->rip;
+		sample.thread = &thread;
+
+		if (buffer.count == PROFILE_BUFFER_SIZE) {
+			__atomic_store_n(&_dump_pending, true, __ATOMIC_RELAXED);
+		}
+	}
+
+	/**
+	 * Takes a consistent copy of the base timepoint, and of the floor, without disabling interrupts
+	 * or touching the RTC.
+	 * @param tp Populated with the base timepoint.
+	 * @param century Populated with the century of the base timepoint, or zero if it is not known.
+	 * @param runtime Populated with the kernel runtime at which the base timepoint was read.
+	 * @param floor Populated with the floor, if there is one.
+	 * @param floor_century Populated with the century of the floor.
+	 * @param has_floor Populated with whether the time is being held at the floor.
+	 */
+	void read_base(RTCTimePoint& tp, unsigned int& century, uint64_t& runtime, RTCTimePoint& floor,
+			unsigned int& floor_century, bool& has_floor)
+	{
+		uint64_t seq;
+
+		do {
+			seq = _base_seq;
+			__sync_synchronize();
+
+			tp = _base;
+			century = _base_century;
+			runtime = _base_runtime;
+			floor = _floor;
+			floor_century = _floor_century;
+			has_floor = _has_floor;
+
+			__sync_synchronize();
+		} while ((seq & 1) || seq != _base_seq);
+	}
+
+	/**
+	 * Checks whether one timepoint is before another.
+	 * @param a The first timepoint.
+	 * @param a_century The century of the first timepoint, or zero to take it to be in the 2000s.
+	 * @param b The second timepoint.
+	 * @param b_century The century of the second timepoint, or zero to take it to be in the 2000s.
+	 */
+	static bool earlier(const RTCTimePoint& a, unsigned int a_century, const RTCTimePoint& b, unsigned int b_century)
+	{
+		return sort_key(a, a_century) < sort_key(b, b_century);
+	}
+
+	/**
+	 * Turns a timepoint into a number that sorts in the same order as the time, without the cost of
+	 * working out how many days have gone by since the epoch.
+	 * @param tp The timepoint to convert.
+	 * @param century The century of the timepoint, or zero to take it to be in the 2000s.
+	 */
+	static inline uint64_t sort_key(const RTCTimePoint& tp, unsigned int century)
+	{
+		uint64_t year = (century ? century * 100 : 2000) + tp.year;
+		return (((((year * 16 + tp.month) * 32 + tp.day_of_month) * 24 + tp.hours) * 60 + tp.minutes) * 60) + tp.seconds;
+	}
+
+	/**
+	 * Checks whether a year is a leap year.
+	 * @param year The year, either in full or as the last two digits.
+	 */
+	static inline bool is_leap_year(unsigned int year)
+	{
+		return ((year % 4) == 0 && (year % 100) != 0) || (year % 400) == 0;
+	}
+
+	/**
+	 * Returns the number of days in a month.
+	 * @param month The month, from 1 to 12.
+	 * @param year The year the month is in.
+	 */
+	static inline unsigned int days_in_month(unsigned int month, unsigned int year)
+	{
+		static const unsigned char days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+		if (month == 2 && is_leap_year(year)) {
+			return 29;
+		}
+
+		return days[(month - 1) % 12];
+	}
+
+	/**
+	 * Moves a timepoint forwards, carrying into the minutes, hours, days, months and years as needed.
+	 * @param tp The timepoint to move forwards.
+	 * @param seconds The number of seconds to move it by.
+	 */
+	void advance_timepoint(RTCTimePoint& tp, uint64_t seconds)
+	{
+		if (seconds == 0) {
+			return;
+		}
+
+		seconds += tp.seconds;
+		tp.seconds = seconds % 60;
+
+		uint64_t minutes = tp.minutes + (seconds / 60);
+		tp.minutes = minutes % 60;
+
+		uint64_t hours = tp.hours + (minutes / 60);
+		tp.hours = hours % 24;
+
+		uint64_t days = hours / 24;
+		while (days > 0) {
+			auto remaining_in_month = days_in_month(tp.month, tp.year) - tp.day_of_month;
+
+			if (days <= remaining_in_month) {
+				tp.day_of_month += days;
+				break;
+			}
+
+			// Move to the first of the next month
+			days -= remaining_in_month + 1;
+			tp.day_of_month = 1;
+
+			if (++tp.month > 12) {
+				tp.month = 1;
+
+				// Two-digit years wrap around, just like the RTC's own year register
+				if (++tp.year == 100) {
+					tp.year = 0;
+				}
+			}
 		}
+	}
+
+	/**
+	 * Reads a specific register from the CMOS
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param reg The register to read
+	 * @return The data at the given register
+	 */
+	uint8_t get_cmos_register(int reg)
+	{
+		_port_io_count += 2;
 
-		return RTCTimePoint{
-			.seconds = get_cmos_register(0x00),
-			.minutes = get_cmos_register(0x02),
-			.hours = get_cmos_register(0x04),
-			.day_of_month = get_cmos_register(0x07),
-			.month = get_cmos_register(0x08),
-			.year = get_cmos_register(0x09),
-		};
+		__outb(CMOS_ADDRESS, reg); // activate the register
+		return __inb(CMOS_DATA);
 	}
 
 	/**
-	 * Checks to see if two timepoints are equal
-	 * @param a Timepoint A
-	 * @param b Timepoint B
-	 * @return true if timepoint A == timepoint B, false otherwise
+	 * Writes a specific register in the CMOS
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param reg The register to write
+	 * @param value The value to write to the register
 	 */
-	bool tp_eq(RTCTimePoint a, RTCTimePoint b) {
-		return (
-			(a.seconds == b.seconds) &&
-			(a.minutes == b.minutes) &&
-			(a.hours == b.hours) &&
-			(a.day_of_month == b.day_of_month) &&
-			(a.month == b.month) &&
-			(a.year == b.year) &&
-			true
-		);
+	void set_cmos_register(int reg, uint8_t value)
+	{
+		_port_io_count += 2;
+
+		__outb(CMOS_ADDRESS, reg); // activate the register
+		__outb(CMOS_DATA, value);
 	}
 
 	/**
@@ -201,6 +1061,15 @@ private:
 	constexpr inline unsigned short from_bcd(unsigned short n) {
 		return ((n >> 4) * 10) + (n & 0xF);
 	}
+
+	/**
+	 * Converts a two-digit native number to BCD
+	 * @param n The natively understood number
+	 * @return The binary-coded decimal number
+	 */
+	constexpr inline uint8_t to_bcd(unsigned short n) {
+		return ((n / 10) << 4) | (n % 10);
+	}
 };
 
 const DeviceClass CMOSRTC::CMOSRTCDeviceClass(RTC::RTCDeviceClass, "cmos-rtc");
@@ -0,0 +1,69 @@
+/*
+ * CPU Identification
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#pragma once
+
+#include <stdint.h>
+
+// The number of CPUs that per-CPU state is kept for.  CPUs beyond this share state.
+#define MAX_CPUS		16
+
+// The model-specific register that RDTSCP reads back alongside the timestamp counter.
+#define MSR_TSC_AUX		0xc0000103
+
+// Whether RDTSCP can be used, once it has been checked for.
+#define RDTSCP_UNCHECKED	0
+#define RDTSCP_SUPPORTED	1
+#define RDTSCP_UNSUPPORTED	2
+
+static unsigned int rdtscp_support = RDTSCP_UNCHECKED;
+
+/**
+ * Returns the (initial) APIC ID of the CPU this code is running on, straight from CPUID.
+ */
+static inline unsigned int cpuid_apic_id()
+{
+	uint32_t eax = 1, ebx, ecx = 0, edx;
+	asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+
+	return ebx >> 24;
+}
+
+/**
+ * Returns the (initial) APIC ID of the CPU this code is running on.
+ *
+ * CPUID is serialising, and under virtualisation every CPUID exits to the hypervisor, which is far too
+ * slow for the scheduler and page allocator fast paths.  So where RDTSCP is available, each CPU caches
+ * its ID in its TSC_AUX register the first time it is asked, and RDTSCP reads it back.  The ID is stored
+ * plus one, so that the reset value of zero means it has not been cached yet.
+ */
+static inline unsigned int current_cpu()
+{
+	if (rdtscp_support == RDTSCP_UNCHECKED) {
+		// RDTSCP support is reported in bit 27 of EDX, in the extended feature leaf.
+		uint32_t eax = 0x80000001, ebx, ecx = 0, edx;
+		asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+
+		rdtscp_support = (edx & (1 << 27)) ? RDTSCP_SUPPORTED : RDTSCP_UNSUPPORTED;
+	}
+
+	if (rdtscp_support == RDTSCP_UNSUPPORTED) {
+		return cpuid_apic_id();
+	}
+
+	uint32_t low, high, aux;
+	asm volatile("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+
+	if (aux) {
+		return aux - 1;
+	}
+
+	unsigned int id = cpuid_apic_id();
+	asm volatile("wrmsr" : : "c"(MSR_TSC_AUX), "a"(id + 1), "d"(0));
+
+	return id;
+}
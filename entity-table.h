@@ -0,0 +1,80 @@
+/*
+ * Per-Entity Scheduling State
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#pragma once
+
+#include <infos/kernel/sched.h>
+#include <infos/util/list.h>
+
+// The number of buckets used to look up per-entity scheduling state.
+#define ENTITY_BUCKETS		64
+
+/**
+ * Checks whether an entity that is leaving the runqueue is going away for good, e.g. a thread that
+ * has exited.  The scheduler stops an entity before taking it off the runqueue, so this is the last
+ * an algorithm hears of it: any state kept for it must be freed there and then, or it would be
+ * inherited by the next entity created at the same address.
+ * @param entity The entity leaving the runqueue.
+ * @return Returns TRUE if the entity has stopped, FALSE otherwise.
+ */
+static inline bool entity_exiting(const infos::kernel::SchedulingEntity& entity)
+{
+	return entity.state() == infos::kernel::SchedulingEntityState::STOPPED;
+}
+
+/**
+ * A table of per-entity scheduling state, hashed by entity address.  The table only links records
+ * together: creating and freeing them is left to the owner, which knows what else refers to them.
+ * Each record must have an "entity" member, naming the entity it belongs to.
+ */
+template<typename T>
+class EntityTable
+{
+public:
+	/**
+	 * Finds the record for an entity.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param entity The entity to look up.
+	 * @return The record of the entity, or nullptr if it has none.
+	 */
+	T *lookup(const infos::kernel::SchedulingEntity *entity)
+	{
+		for (auto record : bucket_of(entity)) {
+			if (record->entity == entity) {
+				return record;
+			}
+		}
+
+		return nullptr;
+	}
+
+	/**
+	 * Adds a record to the table.  The entity must not already have one.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void insert(T *record)
+	{
+		bucket_of(record->entity).append(record);
+	}
+
+	/**
+	 * Takes a record out of the table.  The record is not freed.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void remove(T *record)
+	{
+		bucket_of(record->entity).remove(record);
+	}
+
+private:
+	infos::util::List<T *>& bucket_of(const infos::kernel::SchedulingEntity *entity)
+	{
+		return _buckets[((uintptr_t)entity >> 4) % ENTITY_BUCKETS];
+	}
+
+	infos::util::List<T *> _buckets[ENTITY_BUCKETS];
+};
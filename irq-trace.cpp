@@ -0,0 +1,161 @@
+/*
+ * IRQs-off Latency Tracer
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#include <infos/kernel/cmdline.h>
+#include <infos/kernel/log.h>
+
+#include "irq-trace.h"
+
+using namespace infos::kernel;
+
+// Every call site that has been hit at least once.
+static IRQTraceSite *sites;
+
+// The longest IRQs-off window seen, where it happened, and the stack at the time.  These are only
+// updated by whoever holds worst_lock.
+static uint64_t worst_duration;
+static IRQTraceSite *worst_site;
+static uintptr_t worst_stack[IRQ_TRACE_STACK_DEPTH];
+static bool worst_lock;
+
+// Set when there is a worst window that has not been logged yet.
+static bool worst_pending;
+
+bool irq_trace_enabled;
+
+RegisterCmdLineArgument(IRQTrace, "irqtrace")
+{
+	irq_trace_enabled = value[0] == '1';
+}
+
+/**
+ * Returns the log2 bucket for a duration.
+ */
+static inline unsigned int bucket_of(uint64_t duration)
+{
+	unsigned int bucket = duration ? 63 - __builtin_clzll(duration) : 0;
+	return bucket < IRQ_TRACE_BUCKETS ? bucket : IRQ_TRACE_BUCKETS - 1;
+}
+
+/**
+ * Captures return addresses by following the frame-pointer chain.  The walk stops as soon as the
+ * chain stops looking like it belongs to the current stack.
+ */
+static void capture_stack(uintptr_t *stack)
+{
+	uintptr_t *frame = (uintptr_t *)__builtin_frame_address(0);
+	uintptr_t *limit = frame + (0x10000 / sizeof(uintptr_t));
+
+	for (unsigned int i = 0; i < IRQ_TRACE_STACK_DEPTH; i++) {
+		if (!frame || frame >= limit || ((uintptr_t)frame & 7)) {
+			stack[i] = 0;
+			continue;
+		}
+
+		stack[i] = frame[1];
+
+		uintptr_t *next = (uintptr_t *)frame[0];
+		frame = next > frame ? next : nullptr;
+	}
+}
+
+bool irq_trace_record(IRQTraceSite *site, uint64_t duration)
+{
+	// Interrupts are still disabled here, but other CPUs can be recording at the same time.
+	__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&site->total, duration, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&site->histogram[bucket_of(duration)], 1, __ATOMIC_RELAXED);
+
+	uint64_t max = __atomic_load_n(&site->max, __ATOMIC_RELAXED);
+	while (duration > max && !__atomic_compare_exchange_n(&site->max, &max, duration, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		// max now holds the latest value, so try again
+	}
+
+	// The site is only published once its first window has been counted, so the dump never sees a
+	// site with a count of zero.
+	if (!__atomic_exchange_n(&site->registered, true, __ATOMIC_RELAXED)) {
+		do {
+			site->next = __atomic_load_n(&sites, __ATOMIC_RELAXED);
+		} while (!__atomic_compare_exchange_n(&sites, &site->next, site, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+
+	// Only one CPU updates the worst window at a time.  If another CPU is already doing so, this
+	// window is still counted against its site, but is not considered for the worst.
+	if (duration <= __atomic_load_n(&worst_duration, __ATOMIC_RELAXED) || __atomic_exchange_n(&worst_lock, true, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+
+	bool worst = duration > worst_duration;
+	if (worst) {
+		worst_duration = duration;
+		worst_site = site;
+		capture_stack(worst_stack);
+
+		__atomic_store_n(&worst_pending, true, __ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&worst_lock, false, __ATOMIC_RELEASE);
+	return worst;
+}
+
+void irq_trace_report_worst()
+{
+	if (!__atomic_exchange_n(&worst_pending, false, __ATOMIC_RELAXED)) {
+		return;
+	}
+
+	// Take a consistent copy, so that nothing is logged whilst the worst window is being replaced.
+	while (__atomic_exchange_n(&worst_lock, true, __ATOMIC_ACQUIRE)) {
+		// nop
+	}
+
+	uint64_t duration = worst_duration;
+	IRQTraceSite *site = worst_site;
+	uintptr_t stack[IRQ_TRACE_STACK_DEPTH];
+
+	for (unsigned int i = 0; i < IRQ_TRACE_STACK_DEPTH; i++) {
+		stack[i] = worst_stack[i];
+	}
+
+	__atomic_store_n(&worst_lock, false, __ATOMIC_RELEASE);
+
+	syslog.messagef(LogLevel::WARNING, "irqtrace: new worst irqs-off window: %lu ticks at %s:%d (%s)",
+			duration, site->file, site->line, site->function);
+
+	for (unsigned int i = 0; i < IRQ_TRACE_STACK_DEPTH && stack[i]; i++) {
+		syslog.messagef(LogLevel::WARNING, "irqtrace:   #%u %lx", i, stack[i]);
+	}
+}
+
+void irq_trace_dump()
+{
+	if (!irq_trace_enabled) {
+		return;
+	}
+
+	syslog.messagef(LogLevel::INFO, "IRQS-OFF TRACE:");
+
+	for (IRQTraceSite *site = __atomic_load_n(&sites, __ATOMIC_ACQUIRE); site; site = site->next) {
+		uint64_t count = __atomic_load_n(&site->count, __ATOMIC_RELAXED);
+		uint64_t total = __atomic_load_n(&site->total, __ATOMIC_RELAXED);
+
+		syslog.messagef(LogLevel::INFO, "%s:%d (%s) count=%lu mean=%lu max=%lu", site->file, site->line,
+				site->function, count, total / count, site->max);
+
+		for (unsigned int i = 0; i < IRQ_TRACE_BUCKETS; i++) {
+			if (site->histogram[i]) {
+				syslog.messagef(LogLevel::INFO, "  [%lu, %lu) %lu", 1UL << i, 2UL << i, site->histogram[i]);
+			}
+		}
+	}
+
+	// Log the worst window again, even if it has been logged before, so the dump is complete.
+	if (worst_site) {
+		__atomic_store_n(&worst_pending, true, __ATOMIC_RELAXED);
+		irq_trace_report_worst();
+	}
+}
@@ -0,0 +1,149 @@
+/*
+ * IRQs-off Latency Tracer
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#pragma once
+
+#include <stdint.h>
+#include <infos/util/lock.h>
+
+#include "tsc.h"
+
+// The number of log2-sized buckets in each call site's histogram of IRQs-off durations.
+#define IRQ_TRACE_BUCKETS	32
+
+// The number of frames captured from the stack of the worst IRQs-off window.
+#define IRQ_TRACE_STACK_DEPTH	8
+
+/**
+ * The statistics for one place in the code that disables interrupts.
+ */
+struct IRQTraceSite
+{
+	const char *file;
+	int line;
+	const char *function;
+
+	// Whether the site is somewhere that must not write to the log, such as a scheduler callback.
+	bool quiet;
+
+	// All durations are in TSC ticks.
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	uint64_t histogram[IRQ_TRACE_BUCKETS];
+
+	// Links every site that has been hit at least once, so they can be dumped.
+	IRQTraceSite *next;
+	bool registered;
+};
+
+/**
+ * Whether IRQs-off windows are being traced, as asked for with irqtrace=1 on the command line.
+ */
+extern bool irq_trace_enabled;
+
+/**
+ * Records one IRQs-off window against a call site.
+ * @param site The call site that disabled interrupts.
+ * @param duration How long interrupts were disabled for, in TSC ticks.
+ * @return Returns TRUE if this was the longest window seen anywhere so far.
+ */
+extern bool irq_trace_record(IRQTraceSite *site, uint64_t duration);
+
+/**
+ * Logs the worst IRQs-off window seen so far, along with its call stack, if it has not been logged
+ * already.
+ */
+extern void irq_trace_report_worst();
+
+/**
+ * Logs the statistics of every call site that has disabled interrupts, if tracing is enabled.
+ */
+extern void irq_trace_dump();
+
+/**
+ * Declares (once) the trace statistics for the place this macro is used, and evaluates to a pointer
+ * to them.
+ */
+#define IRQ_TRACE_SITE() \
+	({ static IRQTraceSite __irq_trace_site = { __FILE__, __LINE__, __func__, false }; &__irq_trace_site; })
+
+/**
+ * As IRQ_TRACE_SITE(), but for places that must not write to the log, such as scheduler callbacks.  A
+ * new worst window found at such a site is logged later, by the next site that is not quiet.
+ */
+#define IRQ_TRACE_QUIET_SITE() \
+	({ static IRQTraceSite __irq_trace_site = { __FILE__, __LINE__, __func__, true }; &__irq_trace_site; })
+
+/**
+ * Returns TRUE if interrupts are currently enabled.
+ */
+static inline bool interrupts_enabled()
+{
+	uint64_t flags;
+	asm volatile("pushfq; popq %0" : "=r"(flags));
+
+	return (flags & (1 << 9)) != 0;
+}
+
+/**
+ * Disables interrupts for as long as it is in scope, exactly like UniqueIRQLock, but, if tracing is
+ * enabled, also times how long interrupts stay disabled and records it against the given call site.
+ * Only the outermost lock of a nested set is timed, as that is the one that re-enables interrupts.
+ * With tracing disabled, the only extra cost over UniqueIRQLock is checking irq_trace_enabled.
+ *
+ * Usage: TracedIRQLock l(IRQ_TRACE_SITE());
+ */
+class TracedIRQLock
+{
+public:
+	TracedIRQLock(IRQTraceSite *site) : _reporter(site), _traced(irq_trace_enabled && interrupts_enabled())
+	{
+		// Interrupts were disabled by the lock (the last member) just before this.
+		if (_traced) {
+			_start = read_tsc();
+		}
+	}
+
+	~TracedIRQLock()
+	{
+		// Interrupts are re-enabled by the lock after this, and the reporter runs after that.
+		if (_traced) {
+			irq_trace_record(_reporter.site, read_tsc() - _start);
+			_reporter.report = !_reporter.site->quiet;
+		}
+	}
+
+	TracedIRQLock(const TracedIRQLock&) = delete;
+	TracedIRQLock& operator=(const TracedIRQLock&) = delete;
+
+private:
+	/**
+	 * Logs any unreported worst window once interrupts are back on.  As the first member, it is
+	 * destroyed last, after the lock.
+	 */
+	struct Reporter
+	{
+		IRQTraceSite *site;
+		bool report;
+
+		Reporter(IRQTraceSite *site) : site(site), report(false) { }
+
+		~Reporter()
+		{
+			if (report) {
+				irq_trace_report_worst();
+			}
+		}
+	};
+
+	Reporter _reporter;
+	bool _traced;
+	uint64_t _start;
+
+	infos::util::UniqueIRQLock _lock;
+};
@@ -0,0 +1,114 @@
+/*
+ * Page Allocator Controls
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#pragma once
+
+#include <stdint.h>
+#include <infos/mm/page-allocator.h>
+
+/*
+ * The page allocation algorithms are only known to the kernel through the PageAllocatorAlgorithm interface,
+ * so anything an algorithm offers beyond that is reached through these functions instead.  Each forwards to
+ * the buddy allocator, if that is the algorithm the kernel is allocating with (i.e. the one that has been
+ * initialised), and fails otherwise.
+ */
+
+/**
+ * Called to report a free block to the hypervisor.  The block is kept off the free lists until the
+ * function returns, so the report must be complete by then.
+ */
+typedef void (*FreePageReporter)(infos::mm::PageDescriptor *pgd, int order, void *priv);
+
+/**
+ * Sets the function that reports free blocks to the hypervisor, e.g. through a virtio-balloon free page
+ * reporting queue.
+ * @param reporter The function to call for each newly reported block, or NULL to stop reporting.
+ * @param priv A pointer that is passed to the reporter.
+ * @return Returns TRUE if the reporter was set, FALSE if the buddy allocator is not in use.
+ */
+extern bool pgalloc_set_free_page_reporter(FreePageReporter reporter, void *priv);
+
+/**
+ * Reports every large free block that the hypervisor has not been told about yet, once enough memory is
+ * waiting to be reported to make it worthwhile.  Freeing pages never reports anything itself, so this
+ * should be called periodically by the reporting device, from a thread.
+ * @return Returns the number of pages that were reported.
+ */
+extern uint64_t pgalloc_report_free_pages();
+
+/**
+ * Allocates 2^order contiguous pages, preferably from the given NUMA node rather than the calling CPU's.
+ * The pages are freed as any others are.
+ * @param node The node to allocate from, as numbered by "pgalloc.numa-mem".
+ * @param order The power of two, of the number of contiguous pages to allocate.
+ * @return Returns the first page descriptor of the pages, or nullptr if they could not be allocated or the
+ * buddy allocator is not in use.
+ */
+extern infos::mm::PageDescriptor *pgalloc_alloc_pages_node(unsigned int node, int order);
+
+/**
+ * Allocates a kernel thread stack, reusing one recently freed on this CPU if there is one.  The kernel
+ * core's thread code should allocate its stacks through this, and free them with pgalloc_free_stack().
+ * @return Returns the first page descriptor of the stack, or nullptr if it could not be allocated or the
+ * buddy allocator is not in use (in which case the stack should be allocated as any other pages are).
+ */
+extern infos::mm::PageDescriptor *pgalloc_alloc_stack();
+
+/**
+ * Frees a kernel thread stack allocated with pgalloc_alloc_stack(), keeping it for this CPU to reuse.
+ * @param pgd The first page descriptor of the stack.
+ * @return Returns TRUE if the stack was freed, FALSE if the buddy allocator is not in use.
+ */
+extern bool pgalloc_free_stack(infos::mm::PageDescriptor *pgd);
+
+/**
+ * Takes an extra reference to an allocated page, e.g. to share it between two address spaces for
+ * copy-on-write.  The reference is to that one page, even if it was allocated as part of a larger block,
+ * and is dropped by freeing that page on its own (at order 0).  The page is only freed once every reference
+ * to it has been dropped, and the block's allocation still holds one of them until the block is freed.
+ * @param pgd The page descriptor of the page.
+ * @return Returns TRUE if the reference was taken, FALSE if it could not be or the buddy allocator is not
+ * in use.
+ */
+extern bool pgalloc_get_page(infos::mm::PageDescriptor *pgd);
+
+/**
+ * Offers an allocated page for merging with any other page of the same contents, or with the shared zero
+ * page.  This is the allocator's half of same-page merging: the scanner that finds candidate pages, and
+ * remaps them, walks address spaces, and so belongs to the kernel core.  Every mapping of the page must be
+ * read-only (copy-on-write) before it is offered.
+ * @param pgd The page descriptor of the page.
+ * @return Returns the page to map in place of the given one, with a reference taken for the caller.  If
+ * this is not the given page, the caller should remap it, and then free the given page.  The given page
+ * is returned unchanged if the buddy allocator is not in use.
+ */
+extern infos::mm::PageDescriptor *pgalloc_merge_page(infos::mm::PageDescriptor *pgd);
+
+/**
+ * What same-page merging has done so far, and what it has cost.
+ */
+struct PageMergeStats
+{
+	// The pages offered for merging, how many were found to duplicate another (and so could be freed),
+	// and how many of those were merged into the shared zero page.
+	uint64_t scanned;
+	uint64_t merged;
+	uint64_t merged_zero;
+
+	// The pages dropped from the merge table to make room for others.
+	uint64_t evicted;
+
+	// The time spent hashing and comparing pages, in nanoseconds.
+	uint64_t scan_time;
+};
+
+/**
+ * Reads the same-page merging counters.
+ * @param stats Populated with the counters.
+ * @return Returns TRUE if the counters were read, FALSE if the buddy allocator is not in use.
+ */
+extern bool pgalloc_merge_stats(PageMergeStats& stats);
@@ -0,0 +1,104 @@
+/*
+ * Scheduler Controls
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#pragma once
+
+#include <stdint.h>
+#include <infos/kernel/sched.h>
+
+// Returned by sched_next_preemption() when the scheduling tick can be stopped altogether.
+#define NO_PREEMPTION		((infos::kernel::SchedulingEntity::EntityRuntime)-1)
+
+/*
+ * The scheduling algorithms are only known to the kernel through the SchedulingAlgorithm interface, so
+ * anything an algorithm offers beyond that is reached through these functions instead.  Each forwards to
+ * the algorithm that provides it, if that is the algorithm the kernel is scheduling with (i.e. the one
+ * entities are being added to), and fails otherwise.  The system calls that expose them to userspace
+ * belong to the kernel core.
+ */
+
+/**
+ * A scheduling group, or a member of one.  Only the group scheduler knows what is inside.
+ */
+struct GroupNode;
+
+/**
+ * Gives an entity deadline parameters, so that it is scheduled by the deadline class of the round-robin
+ * scheduler.  Every period, the entity is entitled to run for the given runtime, and should have done so
+ * by the given deadline (both relative to the start of the period).
+ * @param entity The entity to update.
+ * @param runtime The CPU time, in nanoseconds, the entity needs in each period.
+ * @param deadline The time, in nanoseconds, from the start of each period by which the runtime must be served.
+ * @param period The length of each period, in nanoseconds.
+ * @return Returns TRUE if the parameters were accepted, or FALSE if they are invalid, would over-subscribe
+ * the CPU, or the round-robin scheduler is not in use.
+ */
+extern bool sched_set_deadline(infos::kernel::SchedulingEntity& entity, infos::kernel::SchedulingEntity::EntityRuntime runtime,
+		infos::kernel::SchedulingEntity::EntityRuntime deadline, infos::kernel::SchedulingEntity::EntityRuntime period);
+
+/**
+ * Removes the deadline parameters from an entity, returning it to plain round-robin scheduling.
+ * @param entity The entity to update.
+ * @return Returns TRUE if the round-robin scheduler is in use, FALSE otherwise.
+ */
+extern bool sched_clear_deadline(infos::kernel::SchedulingEntity& entity);
+
+/**
+ * Returns the number of deadlines missed by the given entity.
+ * @param entity The entity to query.
+ */
+extern uint64_t sched_deadline_misses(infos::kernel::SchedulingEntity& entity);
+
+/**
+ * Hands the rest of the current timeslice straight to another runnable entity, for synchronous IPC.  The
+ * caller should trigger a scheduling event afterwards.
+ * @param target The entity to switch to.
+ * @return Returns TRUE if the timeslice was handed over, FALSE otherwise.
+ */
+extern bool sched_yield_to(infos::kernel::SchedulingEntity& target);
+
+/**
+ * Asks how long the next scheduling tick can be deferred for, because nothing would be preempted
+ * before then.
+ * @param until Set to the time, in nanoseconds, until a scheduling decision could next change, or
+ * NO_PREEMPTION if no tick is needed at all.
+ * @return Returns TRUE if the answer is known, or FALSE if the tick must be kept running.
+ */
+extern bool sched_next_preemption(infos::kernel::SchedulingEntity::EntityRuntime& until);
+
+/**
+ * Sets the number of tickets held by an entity under the stride scheduler, and therefore its share of the CPU.
+ * @param entity The entity to update.
+ * @param tickets The number of tickets the entity should hold.  Must be non-zero.
+ * @return Returns TRUE if the ticket count was applied, FALSE otherwise.
+ */
+extern bool sched_set_tickets(infos::kernel::SchedulingEntity& entity, unsigned int tickets);
+
+/**
+ * Creates a new scheduling group under the group scheduler.
+ * @param name A friendly name for the group, for debugging purposes.
+ * @param weight The share of its parent's CPU time the group receives, relative to its siblings.
+ * @param parent The group to nest the new group in, or nullptr to place it in the root group.
+ * @return Returns the new group, or nullptr if it could not be created.
+ */
+extern GroupNode *sched_create_group(const char *name, unsigned int weight, GroupNode *parent);
+
+/**
+ * Changes the weight of a scheduling group.
+ * @param group The group to update.
+ * @param weight The share of its parent's CPU time the group receives, relative to its siblings.
+ * @return Returns TRUE if the weight was applied, FALSE otherwise.
+ */
+extern bool sched_set_group_weight(GroupNode *group, unsigned int weight);
+
+/**
+ * Moves an entity into a scheduling group.
+ * @param entity The entity to move.
+ * @param group The group the entity should belong to.
+ * @return Returns TRUE if the entity was moved, FALSE otherwise.
+ */
+extern bool sched_set_group(infos::kernel::SchedulingEntity& entity, GroupNode *group);
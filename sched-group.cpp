@@ -0,0 +1,319 @@
+/*
+ * Group Round-robin Scheduling Algorithm
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/log.h>
+#include <infos/util/list.h>
+#include <infos/util/lock.h>
+
+#include "entity-table.h"
+#include "irq-trace.h"
+#include "sched-control.h"
+
+using namespace infos::kernel;
+using namespace infos::util;
+
+/**
+ * A member of the scheduling hierarchy: either a group, or a leaf that wraps a single entity.
+ */
+struct GroupNode
+{
+	// The entity represented by this node, or nullptr if this node is a group.
+	SchedulingEntity *entity;
+
+	const char *name;
+	GroupNode *parent;
+
+	// The number of consecutive turns this node gets when it reaches the front of its parent's
+	// runqueue, and how many of those turns are left.
+	unsigned int weight;
+	unsigned int turns_left;
+
+	// For groups only: the runnable members of the group.
+	List<GroupNode *> runqueue;
+
+	// Whether this node is currently on its parent's runqueue.
+	bool queued;
+};
+
+/**
+ * A hierarchical round-robin scheduling algorithm.  Entities are placed into groups, and groups can be
+ * nested inside other groups.  Each group round-robins between its runnable members (entities and
+ * sub-groups alike), giving each member as many consecutive turns as its weight.  This means a group
+ * receives the same share of the CPU no matter how many entities it contains.
+ */
+class GroupRoundRobinScheduler : public SchedulingAlgorithm
+{
+public:
+	/**
+	 * Returns the friendly name of the algorithm, for debugging and selection purposes.
+	 */
+	const char* name() const override { return "group-rr"; }
+
+	GroupRoundRobinScheduler()
+	{
+		init_node(&_root, nullptr, "root", nullptr, 1);
+	}
+
+	/**
+	 * Called when a scheduling entity becomes eligible for running.
+	 * @param entity
+	 */
+	void add_to_runqueue(SchedulingEntity& entity) override
+	{
+		// You must make sure that interrupts are
+		// disabled when manipulating the runqueue.
+		TracedIRQLock l(IRQ_TRACE_QUIET_SITE());
+
+		active = this;
+		enqueue_node(lookup(&entity, true));
+	}
+
+	/**
+	 * Called when a scheduling entity is no longer eligible for running.
+	 * @param entity
+	 */
+	void remove_from_runqueue(SchedulingEntity& entity) override
+	{
+		// You must make sure that interrupts are
+		// disabled when manipulating the runqueue.
+		TracedIRQLock l(IRQ_TRACE_QUIET_SITE());
+
+		auto node = lookup(&entity, false);
+		if (!node) {
+			return;
+		}
+
+		dequeue_node(node);
+
+		if (entity_exiting(entity)) {
+			_entities.remove(node);
+			delete node;
+		}
+	}
+
+	/**
+	 * Called every time a scheduling event occurs, to cause the next eligible entity
+	 * to be chosen.  The next eligible entity might actually be the same entity, if
+	 * e.g. its timeslice has not expired.
+	 *
+	 * In our case, starting from the root group, the member at the front of each group's
+	 * runqueue uses up one of its turns, and is moved to the back once it has none left.
+	 * This is repeated down the hierarchy until an entity is reached, so the cost of picking
+	 * depends on the depth of the hierarchy rather than the number of entities.
+	 */
+	SchedulingEntity *pick_next_entity() override
+	{
+		// If there's nothing in our queue, return nothing
+		if (_root.runqueue.empty()) {
+			return nullptr;
+		}
+
+		// You must make sure that interrupts are
+		// disabled when manipulating the runqueue.
+		TracedIRQLock l(IRQ_TRACE_QUIET_SITE());
+
+		GroupNode *node = &_root;
+		while (!node->entity) {
+			auto next = node->runqueue.first();
+
+			// Rotate the member to the back once it has used all its turns
+			if (--next->turns_left == 0) {
+				next->turns_left = next->weight;
+
+				if (node->runqueue.count() > 1) {
+					node->runqueue.dequeue();
+					node->runqueue.enqueue(next);
+				}
+			}
+
+			node = next;
+		}
+
+		return node->entity;
+	}
+
+	/**
+	 * The instance the kernel is scheduling with: the one entities are being added to.
+	 */
+	static GroupRoundRobinScheduler *active;
+
+	/**
+	 * Returns the root group, to which entities belong until they are moved elsewhere.
+	 */
+	GroupNode *root_group() { return &_root; }
+
+	/**
+	 * Creates a new scheduling group.
+	 * @param name A friendly name for the group, for debugging purposes.
+	 * @param weight The share of its parent's CPU time the group receives, relative to its siblings.
+	 * @param parent The group to nest the new group in, or nullptr to place it in the root group.
+	 * @return Returns the new group, or nullptr if the weight is invalid.
+	 */
+	GroupNode *create_group(const char *name, unsigned int weight, GroupNode *parent = nullptr)
+	{
+		if (weight == 0 || (parent && parent->entity)) {
+			return nullptr;
+		}
+
+		TracedIRQLock l(IRQ_TRACE_SITE());
+
+		auto group = new GroupNode();
+		init_node(group, nullptr, name, parent ? parent : &_root, weight);
+
+		return group;
+	}
+
+	/**
+	 * Changes the weight of a group.
+	 * @param group The group to update.
+	 * @param weight The share of its parent's CPU time the group receives, relative to its siblings.
+	 * @return Returns TRUE if the weight was applied, FALSE otherwise.
+	 */
+	bool set_group_weight(GroupNode *group, unsigned int weight)
+	{
+		if (weight == 0 || group->entity || group == &_root) {
+			return false;
+		}
+
+		TracedIRQLock l(IRQ_TRACE_SITE());
+
+		group->weight = weight;
+		if (group->turns_left > weight) {
+			group->turns_left = weight;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Moves an entity into a group.
+	 * @param entity The entity to move.
+	 * @param group The group the entity should belong to.
+	 * @return Returns TRUE if the entity was moved, FALSE otherwise.
+	 */
+	bool set_group(SchedulingEntity& entity, GroupNode *group)
+	{
+		if (group->entity) {
+			return false;
+		}
+
+		TracedIRQLock l(IRQ_TRACE_SITE());
+
+		auto node = lookup(&entity, true);
+		bool was_queued = node->queued;
+
+		if (was_queued) {
+			dequeue_node(node);
+		}
+
+		node->parent = group;
+
+		if (was_queued) {
+			enqueue_node(node);
+		}
+
+		return true;
+	}
+
+private:
+	/**
+	 * Initialises a node in the hierarchy.
+	 */
+	void init_node(GroupNode *node, SchedulingEntity *entity, const char *name, GroupNode *parent, unsigned int weight)
+	{
+		node->entity = entity;
+		node->name = name;
+		node->parent = parent;
+		node->weight = weight;
+		node->turns_left = weight;
+		node->queued = false;
+	}
+
+	/**
+	 * Finds the leaf node for an entity.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param entity The entity to look up.
+	 * @param create Whether or not to create the node (in the root group), if the entity has not been seen before.
+	 * @return The node for the entity, or nullptr if there was none (and create was FALSE).
+	 */
+	GroupNode *lookup(SchedulingEntity *entity, bool create)
+	{
+		auto node = _entities.lookup(entity);
+
+		if (node || !create) {
+			return node;
+		}
+
+		node = new GroupNode();
+		init_node(node, entity, nullptr, &_root, 1);
+
+		_entities.insert(node);
+		return node;
+	}
+
+	/**
+	 * Makes a node runnable, and makes each group above it runnable if it was not already.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void enqueue_node(GroupNode *node)
+	{
+		while (node->parent && !node->queued) {
+			node->queued = true;
+			node->turns_left = node->weight;
+			node->parent->runqueue.enqueue(node);
+
+			node = node->parent;
+		}
+	}
+
+	/**
+	 * Makes a node no longer runnable, along with each group above it that has nothing else to run.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void dequeue_node(GroupNode *node)
+	{
+		while (node->parent && node->queued) {
+			node->queued = false;
+			node->parent->runqueue.remove(node);
+
+			if (!node->parent->runqueue.empty()) {
+				break;
+			}
+
+			node = node->parent;
+		}
+	}
+
+	// The root of the hierarchy.
+	GroupNode _root;
+
+	// The leaf node of every entity this algorithm has seen, hashed by entity address.
+	EntityTable<GroupNode> _entities;
+};
+
+GroupRoundRobinScheduler *GroupRoundRobinScheduler::active;
+
+GroupNode *sched_create_group(const char *name, unsigned int weight, GroupNode *parent)
+{
+	return GroupRoundRobinScheduler::active ? GroupRoundRobinScheduler::active->create_group(name, weight, parent) : nullptr;
+}
+
+bool sched_set_group_weight(GroupNode *group, unsigned int weight)
+{
+	return GroupRoundRobinScheduler::active && GroupRoundRobinScheduler::active->set_group_weight(group, weight);
+}
+
+bool sched_set_group(SchedulingEntity& entity, GroupNode *group)
+{
+	return GroupRoundRobinScheduler::active && GroupRoundRobinScheduler::active->set_group(entity, group);
+}
+
+/* --- DO NOT CHANGE ANYTHING BELOW THIS LINE --- */
+
+RegisterScheduler(GroupRoundRobinScheduler);
@@ -7,16 +7,135 @@
  * STUDENT NUMBER: s1620208
  */
 #include <infos/kernel/sched.h>
+#include <infos/kernel/kernel.h>
 #include <infos/kernel/thread.h>
 #include <infos/kernel/log.h>
 #include <infos/util/list.h>
 #include <infos/util/lock.h>
 
+#include "cpu.h"
+#include "entity-table.h"
+#include "irq-trace.h"
+#include "sched-control.h"
+
 using namespace infos::kernel;
 using namespace infos::util;
 
+// The period (in nanoseconds) over which every runnable entity should get to run once.
+#define TARGET_LATENCY		6000000
+
+// The shortest timeslice (in nanoseconds) handed out, no matter how long the runqueue gets.
+#define MIN_GRANULARITY		750000
+
+// The largest share of the CPU (in parts per thousand) that deadline entities may reserve between
+// them, so that round-robin entities are never starved outright.
+#define DEADLINE_MAX_UTILISATION	950
+
+// How long (in nanoseconds) after an entity last ran that its cache footprint is assumed to survive.
+#define CACHE_HOT_TIME		500000
+
+// How many entities from the front of the runqueue are considered when looking for a cache-hot one.
+#define AFFINITY_LOOKAHEAD	4
+
+// The number of wakeups each per-CPU wakeup list can hold (a power of two).
+#define WAKEUP_LIST_SIZE	64
+
+/**
+ * A bounded, lock-free queue of entities that have woken up but are not yet on the runqueue.  Any
+ * CPU (or interrupt handler) can push onto it with a single compare-and-swap, and it is drained in a
+ * batch by whoever next picks an entity.  Each cell carries a sequence number that says whether it is
+ * ready to be written or ready to be read, so pushes and pops never need a lock.
+ */
+struct WakeupList
+{
+	struct Cell
+	{
+		uint64_t sequence;
+		SchedulingEntity *entity;
+	};
+
+	Cell cells[WAKEUP_LIST_SIZE];
+	uint64_t head;
+	uint64_t tail;
+
+	WakeupList() : head(0), tail(0)
+	{
+		for (unsigned int i = 0; i < WAKEUP_LIST_SIZE; i++) {
+			cells[i].sequence = i;
+		}
+	}
+
+	/**
+	 * Adds an entity to the list.
+	 * @param entity The entity that has woken up.
+	 * @return Returns TRUE if the entity was added, or FALSE if the list is full.
+	 */
+	bool push(SchedulingEntity *entity)
+	{
+		Cell *cell;
+		uint64_t pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+
+		while (true) {
+			cell = &cells[pos & (WAKEUP_LIST_SIZE - 1)];
+			int64_t diff = (int64_t)__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (int64_t)pos;
+
+			if (diff == 0) {
+				// The cell is free: try to claim it
+				if (__atomic_compare_exchange_n(&tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+					break;
+				}
+			} else if (diff < 0) {
+				// The cell has not been read since the list last wrapped around, so the list is full
+				return false;
+			} else {
+				// Someone else claimed the cell first
+				pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+			}
+		}
+
+		cell->entity = entity;
+		__atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+
+		return true;
+	}
+
+	/**
+	 * Takes the oldest entity off the list.
+	 * @return The entity, or nullptr if the list is empty.
+	 */
+	SchedulingEntity *pop()
+	{
+		Cell *cell;
+		uint64_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+
+		while (true) {
+			cell = &cells[pos & (WAKEUP_LIST_SIZE - 1)];
+			int64_t diff = (int64_t)__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (int64_t)(pos + 1);
+
+			if (diff == 0) {
+				// The cell has been written: try to claim it
+				if (__atomic_compare_exchange_n(&head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+					break;
+				}
+			} else if (diff < 0) {
+				// Nothing has been written here yet, so the list is empty
+				return nullptr;
+			} else {
+				pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+			}
+		}
+
+		auto entity = cell->entity;
+		__atomic_store_n(&cell->sequence, pos + WAKEUP_LIST_SIZE, __ATOMIC_RELEASE);
+
+		return entity;
+	}
+};
+
 /**
- * A round-robin scheduling algorithm
+ * A round-robin scheduling algorithm, with an earliest-deadline-first class sitting above it.
+ * Entities given deadline parameters are picked in deadline order whilst they have budget left
+ * in their current period, and otherwise compete in the round-robin like everything else.
  */
 class RoundRobinScheduler : public SchedulingAlgorithm
 {
@@ -26,17 +145,35 @@ public:
 	 */
 	const char* name() const override { return "rr"; }
 
+	RoundRobinScheduler() : _deadline_misses(0), _migrations(0), _placements(0), _directed_yields(0)
+	{
+		for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+			_running[cpu] = nullptr;
+		}
+	}
+
 	/**
 	 * Called when a scheduling entity becomes eligible for running.
+	 *
+	 * In our case, the entity is pushed onto this CPU's wakeup list, which does not need
+	 * interrupts disabling, and it joins the runqueue at the next scheduling event.
 	 * @param entity
 	 */
 	void add_to_runqueue(SchedulingEntity& entity) override
 	{
+		active = this;
+
+		if (_wakeups[current_cpu() % MAX_CPUS].push(&entity)) {
+			return;
+		}
+
+		// The wakeup list is full, so fall back to adding to the runqueue directly.
 		// You must make sure that interrupts are
 		// disabled when manipulating the runqueue.
-		UniqueIRQLock l;
+		TracedIRQLock l(IRQ_TRACE_QUIET_SITE());
 
-		runqueue.enqueue(&entity);
+		drain_wakeups();
+		make_runnable(&entity);
 	}
 
 	/**
@@ -47,9 +184,41 @@ public:
 	{
 		// You must make sure that interrupts are
 		// disabled when manipulating the runqueue.
-		UniqueIRQLock l;
+		TracedIRQLock l(IRQ_TRACE_QUIET_SITE());
+
+		// The entity may still be waiting on a wakeup list
+		drain_wakeups();
 
 		runqueue.remove(&entity);
+
+		auto deadline_entity = lookup_deadline_entity(&entity);
+		if (deadline_entity) {
+			charge(deadline_entity);
+			deadline_entity->runnable = false;
+		}
+
+		// The running entity has gone, so its timeslice goes with it.
+		end_timeslices(&entity);
+
+		for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+			if (_running[cpu] == &entity) {
+				_running[cpu] = nullptr;
+			}
+		}
+
+		// An entity that has exited takes its reservation and placement record with it.
+		if (entity_exiting(entity)) {
+			if (deadline_entity) {
+				_deadline_entities.remove(deadline_entity);
+				delete deadline_entity;
+			}
+
+			auto placement = _placements_by_entity.lookup(&entity);
+			if (placement) {
+				_placements_by_entity.remove(placement);
+				delete placement;
+			}
+		}
 	}
 
 	/**
@@ -59,39 +228,693 @@ public:
 	 *
 	 * In our case, when a new task is picked for execution, it is removed
 	 * from the front of the list, and placed at the back.
-	 * Then, this task is allow to run for its timeslice.
+	 * Then, this task is allow to run for its timeslice, and is returned again on
+	 * every scheduling event until that timeslice has been used up.
 	 */
 	SchedulingEntity *pick_next_entity() override
 	{
+		// You must make sure that interrupts are
+		// disabled when manipulating the runqueue.
+		TracedIRQLock l(IRQ_TRACE_QUIET_SITE());
+
+		// Bring in everything that has woken up since the last scheduling event
+		drain_wakeups();
+
 		// If there's nothing in our queue, return nothing
 		if (runqueue.empty()) {
 			return nullptr;
 		}
 
+		unsigned int cpu = current_cpu();
+		SchedulingEntity::EntityStartTime now = sys.runtime();
+
 		// Don't bother with the overhead if we only have one item
 		if (runqueue.count() == 1) {
-			return runqueue.first();
+			return record_placement(runqueue.first(), cpu, now);
 		}
 
-		// You must make sure that interrupts are
-		// disabled when manipulating the runqueue.
-		UniqueIRQLock l;
+		auto& slice = _slices[cpu % MAX_CPUS];
+
+		// Deadline entities with budget remaining always win
+		auto deadline_entity = pick_deadline_entity(now);
+		if (deadline_entity) {
+			return record_placement(deadline_entity->entity, cpu, now);
+		}
 
-		// Remove from the front of the list
-		auto entity = runqueue.dequeue();
+		// Keep running the current entity until its timeslice is exhausted
+		if (slice.entity && slice_remaining(slice) > 0) {
+			return record_placement(slice.entity, cpu, now);
+		}
+
+		// Remove from the front of the list, unless one of the entities near the front
+		// last ran on this CPU and is still cache-hot.  The entity that has just had its
+		// turn here is always cache-hot, so it is left to wait at the back.
+		auto entity = find_cache_hot_entity(cpu, now, _running[cpu % MAX_CPUS]);
+		if (entity) {
+			runqueue.remove(entity);
+		} else {
+			entity = runqueue.dequeue();
+		}
 
 		// Add it to the end of the list
 		runqueue.enqueue(entity);
 
+		// Give it a fresh timeslice
+		start_slice(slice, entity, slice_length());
+
 		// Return our entity
-		return entity;
+		return record_placement(entity, cpu, now);
 	}
 
+	/**
+	 * Hands the rest of the current timeslice straight to another runnable entity, so that it runs at the
+	 * next scheduling event rather than waiting its turn in the rotation.  This is intended for synchronous
+	 * IPC, where a client wakes a server and then blocks waiting for the reply.  The caller should trigger
+	 * a scheduling event afterwards.
+	 * @param target The entity to switch to.
+	 * @return Returns TRUE if the timeslice was handed over, or FALSE if the target is not runnable, or
+	 * there was no timeslice left to hand over (including when the caller is running on a deadline budget).
+	 */
+	bool yield_to(SchedulingEntity& target)
+	{
+		TracedIRQLock l(IRQ_TRACE_SITE());
+
+		// The target has most likely only just been woken up
+		drain_wakeups();
+
+		unsigned int cpu = current_cpu() % MAX_CPUS;
+		auto& slice = _slices[cpu];
+		if (&target == slice.entity || !runqueue_contains(&target)) {
+			return false;
+		}
+
+		// A deadline entity running on its budget holds no timeslice, and its budget is reserved for
+		// it alone, so it has nothing it may lend.
+		auto caller = _running[cpu];
+		if (caller && caller != slice.entity && lookup_deadline_entity(caller)) {
+			return false;
+		}
+
+		// The target inherits what is left of the lender's timeslice, or a fresh one if nothing
+		// currently holds a timeslice.  Handing over an empty timeslice would let the target jump
+		// the queue for free.
+		SchedulingEntity::EntityRuntime remaining = slice.entity ? slice_remaining(slice) : slice_length();
+		if (remaining == 0) {
+			return false;
+		}
+
+		// Move the target to the back of the list, exactly as if it had been picked in turn.
+		runqueue.remove(&target);
+		runqueue.enqueue(&target);
+
+		start_slice(slice, &target, remaining);
+
+		_directed_yields++;
+		return true;
+	}
+
+	/**
+	 * Returns the number of timeslices that have been handed over with yield_to().
+	 */
+	uint64_t directed_yields() const { return _directed_yields; }
+
+	/**
+	 * Gives an entity deadline parameters, so that it is scheduled by the deadline class.  Every period,
+	 * the entity is entitled to run for the given runtime, and should have done so by the given deadline
+	 * (both relative to the start of the period).
+	 * @param entity The entity to update.
+	 * @param runtime The CPU time, in nanoseconds, the entity needs in each period.
+	 * @param deadline The time, in nanoseconds, from the start of each period by which the runtime must be served.
+	 * @param period The length of each period, in nanoseconds.
+	 * @return Returns TRUE if the parameters were accepted, or FALSE if they are invalid or would
+	 * over-subscribe the CPU.
+	 */
+	bool set_deadline(SchedulingEntity& entity, SchedulingEntity::EntityRuntime runtime,
+			SchedulingEntity::EntityRuntime deadline, SchedulingEntity::EntityRuntime period)
+	{
+		if (runtime == 0 || runtime > deadline || deadline > period) {
+			return false;
+		}
+
+		TracedIRQLock l(IRQ_TRACE_SITE());
+
+		drain_wakeups();
+
+		auto deadline_entity = lookup_deadline_entity(&entity);
+
+		// Admission test: the total utilisation, without this entity's old reservation, plus the new
+		// reservation must fit within the limit.
+		uint64_t utilisation = (runtime * 1000) / period;
+		for (auto other : _deadline_entities) {
+			if (other != deadline_entity) {
+				utilisation += (other->runtime * 1000) / other->period;
+			}
+		}
+
+		if (utilisation > DEADLINE_MAX_UTILISATION) {
+			return false;
+		}
+
+		if (!deadline_entity) {
+			deadline_entity = new DeadlineEntity();
+			deadline_entity->entity = &entity;
+			deadline_entity->misses = 0;
+			deadline_entity->runnable = runqueue_contains(&entity);
+			_deadline_entities.append(deadline_entity);
+		}
+
+		deadline_entity->runtime = runtime;
+		deadline_entity->deadline = deadline;
+		deadline_entity->period = period;
+		deadline_entity->period_start = sys.runtime();
+		deadline_entity->budget = runtime;
+		deadline_entity->charged_runtime = entity.cpu_runtime();
+		deadline_entity->missed = false;
+
+		return true;
+	}
+
+	/**
+	 * Removes the deadline parameters from an entity, returning it to plain round-robin scheduling.
+	 * @param entity The entity to update.
+	 */
+	void clear_deadline(SchedulingEntity& entity)
+	{
+		TracedIRQLock l(IRQ_TRACE_SITE());
+
+		auto deadline_entity = lookup_deadline_entity(&entity);
+		if (deadline_entity) {
+			_deadline_entities.remove(deadline_entity);
+			delete deadline_entity;
+		}
+	}
+
+	/**
+	 * Returns the number of deadlines missed by all deadline entities.
+	 */
+	uint64_t deadline_misses() const { return _deadline_misses; }
+
+	/**
+	 * Returns the number of deadlines missed by the given entity.
+	 * @param entity The entity to query.
+	 */
+	uint64_t deadline_misses(SchedulingEntity& entity)
+	{
+		TracedIRQLock l(IRQ_TRACE_SITE());
+
+		auto deadline_entity = lookup_deadline_entity(&entity);
+		return deadline_entity ? deadline_entity->misses : 0;
+	}
+
+	/**
+	 * Tells the timer subsystem how long the next scheduling tick can be deferred for, because nothing
+	 * would be preempted before then.  The timer subsystem should combine this with its own next timer
+	 * event, and ask again whenever an entity is added to the runqueue.
+	 * @return The time, in nanoseconds, until a scheduling decision could next change, or NO_PREEMPTION
+	 * if no tick is needed at all.
+	 */
+	SchedulingEntity::EntityRuntime next_preemption()
+	{
+		TracedIRQLock l(IRQ_TRACE_QUIET_SITE());
+
+		drain_wakeups();
+
+		// Idle: nothing can be preempted until something wakes up.
+		if (runqueue.empty()) {
+			return NO_PREEMPTION;
+		}
+
+		SchedulingEntity::EntityStartTime now = sys.runtime();
+		SchedulingEntity::EntityRuntime until = NO_PREEMPTION;
+
+		// A deadline entity may need to take over the CPU when its next period starts, and must give
+		// it up again when its budget runs out.  One that is asleep cannot take over until it wakes,
+		// and the timer subsystem asks again then.
+		for (auto deadline_entity : _deadline_entities) {
+			if (!deadline_entity->runnable) {
+				continue;
+			}
+
+			// Bring the entity up to date, so that a period that has already ended is not waited for.
+			charge(deadline_entity);
+			update_period(deadline_entity, now);
+
+			until = earliest(until, deadline_entity->period_start + deadline_entity->period - now);
+
+			if (deadline_entity->budget > 0) {
+				until = earliest(until, deadline_entity->budget);
+			}
+		}
+
+		// A lone entity has nothing to be rotated out in favour of.
+		if (runqueue.count() == 1) {
+			return until;
+		}
+
+		// Otherwise, the next rotation happens when this CPU's timeslice runs out.
+		auto& slice = _slices[current_cpu() % MAX_CPUS];
+		return earliest(until, slice.entity ? slice_remaining(slice) : 0);
+	}
+
+	/**
+	 * The instance the kernel is scheduling with: the one entities are being added to.
+	 */
+	static RoundRobinScheduler *active;
+
+	/**
+	 * Returns the number of times an entity has woken up and then first run on a different CPU to the one
+	 * it last ran on.
+	 */
+	uint64_t migrations() const { return _migrations; }
+
+	/**
+	 * Returns the number of times an entity has woken up and then first run, so that migrations can be
+	 * expressed as a rate.
+	 */
+	uint64_t placements() const { return _placements; }
+
 private:
+	/**
+	 * Per-entity state for the deadline class.
+	 */
+	struct DeadlineEntity
+	{
+		SchedulingEntity *entity;
+
+		// The parameters of the entity, in nanoseconds.
+		SchedulingEntity::EntityRuntime runtime;
+		SchedulingEntity::EntityRuntime deadline;
+		SchedulingEntity::EntityRuntime period;
+
+		// When the current period started, and how much runtime is left in it.
+		SchedulingEntity::EntityStartTime period_start;
+		SchedulingEntity::EntityRuntime budget;
+
+		// The CPU runtime of the entity, the last time it was charged against its budget.
+		SchedulingEntity::EntityRuntime charged_runtime;
+
+		uint64_t misses;
+		bool runnable;
+
+		// Whether a miss has already been counted for the current period.
+		bool missed;
+	};
+
+	/**
+	 * A timeslice held by an entity on one CPU.  Each CPU rotates through the shared runqueue on its own
+	 * timeslice, so that one CPU's scheduling events do not cut short the entity running on another.
+	 */
+	struct Timeslice
+	{
+		// The entity holding the timeslice, and where the timeslice began (in terms of the entity's
+		// CPU runtime).
+		SchedulingEntity *entity;
+		SchedulingEntity::EntityRuntime start;
+		SchedulingEntity::EntityRuntime length;
+
+		Timeslice() : entity(nullptr), start(0), length(0) { }
+	};
+
+	/**
+	 * Places a woken entity on the runqueue.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void make_runnable(SchedulingEntity *entity)
+	{
+		runqueue.enqueue(entity);
+
+		// Where the entity runs next is a new placement.
+		lookup_placement(entity, true)->woken = true;
+
+		auto deadline_entity = lookup_deadline_entity(entity);
+		if (!deadline_entity) {
+			return;
+		}
+
+		// An entity that wakes too late to use the rest of its budget by its deadline, without running
+		// faster than its reservation allows, starts a new period now.  Otherwise it would be charged
+		// with missing a deadline that passed (or became unreachable) whilst it was asleep.
+		SchedulingEntity::EntityStartTime now = sys.runtime();
+		auto absolute_deadline = deadline_entity->period_start + deadline_entity->deadline;
+
+		if (now >= absolute_deadline ||
+				deadline_entity->budget * deadline_entity->deadline > (absolute_deadline - now) * deadline_entity->runtime) {
+			deadline_entity->period_start = now;
+			deadline_entity->budget = deadline_entity->runtime;
+			deadline_entity->missed = false;
+		}
+
+		deadline_entity->runnable = true;
+		deadline_entity->charged_runtime = entity->cpu_runtime();
+	}
+
+	/**
+	 * Moves every entity waiting on a wakeup list onto the runqueue, in one batch.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void drain_wakeups()
+	{
+		for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+			SchedulingEntity *entity;
+			while ((entity = _wakeups[cpu].pop()) != nullptr) {
+				make_runnable(entity);
+			}
+		}
+	}
+
+	/**
+	 * Per-entity record of where, and when, the entity last ran.  This outlives the entity's stay on the
+	 * runqueue, so that it is still available when the entity wakes up again.
+	 */
+	struct Placement
+	{
+		SchedulingEntity *entity;
+		unsigned int last_cpu;
+		SchedulingEntity::EntityStartTime last_run;
+
+		// Whether the entity has woken up since it last ran.
+		bool woken;
+	};
+
+	/**
+	 * Finds the placement record for an entity.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param entity The entity to look up.
+	 * @param create Whether or not to create the record, if the entity has not run before.
+	 * @return The placement record of the entity, or nullptr if there was none (and create was FALSE).
+	 */
+	Placement *lookup_placement(SchedulingEntity *entity, bool create)
+	{
+		auto placement = _placements_by_entity.lookup(entity);
+		if (placement || !create) {
+			return placement;
+		}
+
+		placement = new Placement();
+		placement->entity = entity;
+		placement->last_run = 0;
+		placement->woken = false;
+		_placements_by_entity.insert(placement);
+
+		return placement;
+	}
+
+	/**
+	 * Records that an entity is about to run on the given CPU.  If this is the first time it runs since
+	 * waking up, a placement is counted, along with a migration if it last ran elsewhere.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @return Returns the entity, for convenience.
+	 */
+	SchedulingEntity *record_placement(SchedulingEntity *entity, unsigned int cpu, SchedulingEntity::EntityStartTime now)
+	{
+		auto placement = lookup_placement(entity, true);
+
+		if (placement->woken) {
+			placement->woken = false;
+			_placements++;
+
+			// A record that has never run anywhere cannot have migrated.
+			if (placement->last_run && placement->last_cpu != cpu) {
+				_migrations++;
+			}
+		}
+
+		placement->last_cpu = cpu;
+		placement->last_run = now;
+		_running[cpu % MAX_CPUS] = entity;
+
+		return entity;
+	}
+
+	/**
+	 * Looks through the front of the runqueue for an entity that last ran on the given CPU recently enough
+	 * that its working set is probably still in that CPU's caches.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param exclude An entity that must not be chosen, or nullptr.
+	 * @return The first cache-hot entity found, or nullptr if there was none.
+	 */
+	SchedulingEntity *find_cache_hot_entity(unsigned int cpu, SchedulingEntity::EntityStartTime now, SchedulingEntity *exclude)
+	{
+		unsigned int considered = 0;
+
+		for (auto entity : runqueue) {
+			if (considered++ == AFFINITY_LOOKAHEAD) {
+				break;
+			}
+
+			if (entity == exclude) {
+				continue;
+			}
+
+			auto placement = lookup_placement(entity, false);
+			if (placement && placement->last_cpu == cpu && (now - placement->last_run) < CACHE_HOT_TIME) {
+				return entity;
+			}
+		}
+
+		return nullptr;
+	}
+
+	/**
+	 * Finds the deadline state for an entity.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param entity The entity to look up.
+	 * @return The deadline state of the entity, or nullptr if it is not a deadline entity.
+	 */
+	DeadlineEntity *lookup_deadline_entity(SchedulingEntity *entity)
+	{
+		for (auto deadline_entity : _deadline_entities) {
+			if (deadline_entity->entity == entity) {
+				return deadline_entity;
+			}
+		}
+
+		return nullptr;
+	}
+
+	/**
+	 * Checks whether an entity is on the runqueue.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	bool runqueue_contains(SchedulingEntity *entity) const
+	{
+		for (auto candidate : runqueue) {
+			if (candidate == entity) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * Takes the CPU time a deadline entity has used since it was last charged out of its budget.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void charge(DeadlineEntity *deadline_entity)
+	{
+		auto runtime = deadline_entity->entity->cpu_runtime();
+		auto used = runtime - deadline_entity->charged_runtime;
+
+		deadline_entity->budget = used >= deadline_entity->budget ? 0 : deadline_entity->budget - used;
+		deadline_entity->charged_runtime = runtime;
+	}
+
+	/**
+	 * Counts a missed deadline, if the entity still wanted to run when its deadline passed.  A miss is
+	 * only counted once per period.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void check_deadline_miss(DeadlineEntity *deadline_entity)
+	{
+		if (!deadline_entity->missed && deadline_entity->runnable && deadline_entity->budget > 0) {
+			deadline_entity->missed = true;
+			deadline_entity->misses++;
+			_deadline_misses++;
+		}
+	}
+
+	/**
+	 * Moves a deadline entity on to its current period, refilling its budget if a new period has started.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param deadline_entity The entity to update.
+	 * @param now The current time.
+	 */
+	void update_period(DeadlineEntity *deadline_entity, SchedulingEntity::EntityStartTime now)
+	{
+		if (now < deadline_entity->period_start + deadline_entity->period) {
+			if (now > deadline_entity->period_start + deadline_entity->deadline) {
+				check_deadline_miss(deadline_entity);
+			}
+
+			return;
+		}
+
+		// The previous period ended, so any work left over has missed its deadline.
+		check_deadline_miss(deadline_entity);
+
+		// Skip over any whole periods that have gone by, and start afresh.
+		auto periods = (now - deadline_entity->period_start) / deadline_entity->period;
+		deadline_entity->period_start += periods * deadline_entity->period;
+		deadline_entity->budget = deadline_entity->runtime;
+		deadline_entity->missed = false;
+	}
+
+	/**
+	 * Chooses the runnable deadline entity with the earliest absolute deadline, that still has budget left.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param now The current time.
+	 * @return The chosen entity, or nullptr if there is no deadline entity eligible to run.
+	 */
+	DeadlineEntity *pick_deadline_entity(SchedulingEntity::EntityStartTime now)
+	{
+		if (_deadline_entities.empty()) {
+			return nullptr;
+		}
+
+		DeadlineEntity *earliest = nullptr;
+
+		for (auto deadline_entity : _deadline_entities) {
+			// Only runnable entities can have used any CPU time since they were last charged.
+			if (deadline_entity->runnable) {
+				charge(deadline_entity);
+			}
+
+			update_period(deadline_entity, now);
+
+			if (!deadline_entity->runnable || deadline_entity->budget == 0) {
+				continue;
+			}
+
+			if (!earliest || (deadline_entity->period_start + deadline_entity->deadline) < (earliest->period_start + earliest->deadline)) {
+				earliest = deadline_entity;
+			}
+		}
+
+		return earliest;
+	}
+
+	/**
+	 * Returns the earlier of two relative times.
+	 */
+	static inline SchedulingEntity::EntityRuntime earliest(SchedulingEntity::EntityRuntime a, SchedulingEntity::EntityRuntime b)
+	{
+		return a < b ? a : b;
+	}
+
+	/**
+	 * Calculates the timeslice for an entity, based on how many entities are competing for the CPU.
+	 * @return The length of the timeslice, in nanoseconds.
+	 */
+	SchedulingEntity::EntityRuntime slice_length() const
+	{
+		SchedulingEntity::EntityRuntime slice = TARGET_LATENCY / runqueue.count();
+		return slice < MIN_GRANULARITY ? MIN_GRANULARITY : slice;
+	}
+
+	/**
+	 * Starts a new timeslice on a CPU.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param slice The timeslice of the CPU the entity is about to run on.
+	 * @param entity The entity that is about to run.
+	 * @param length The length of the timeslice, in nanoseconds.
+	 */
+	void start_slice(Timeslice& slice, SchedulingEntity *entity, SchedulingEntity::EntityRuntime length)
+	{
+		// An entity can only run on one CPU at a time, so it gives up any timeslice it holds elsewhere.
+		end_timeslices(entity);
+
+		slice.entity = entity;
+		slice.start = entity->cpu_runtime();
+		slice.length = length;
+	}
+
+	/**
+	 * Ends any timeslice held by an entity, on every CPU.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void end_timeslices(SchedulingEntity *entity)
+	{
+		for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+			if (_slices[cpu].entity == entity) {
+				_slices[cpu].entity = nullptr;
+			}
+		}
+	}
+
+	/**
+	 * Works out how much of a timeslice is left.
+	 * @return The remaining time, in nanoseconds, or zero if the timeslice has been used up.
+	 */
+	static SchedulingEntity::EntityRuntime slice_remaining(const Timeslice& slice)
+	{
+		SchedulingEntity::EntityRuntime used = slice.entity->cpu_runtime() - slice.start;
+		return used >= slice.length ? 0 : slice.length - used;
+	}
+
 	// A list containing the current runqueue.
 	List<SchedulingEntity *> runqueue;
+
+	// Entities that have woken up, but have not yet been moved onto the runqueue.
+	WakeupList _wakeups[MAX_CPUS];
+
+	// The timeslice currently held on each CPU.
+	Timeslice _slices[MAX_CPUS];
+
+	// The entities that have deadline parameters, and how many deadlines they have missed in total.
+	List<DeadlineEntity *> _deadline_entities;
+	uint64_t _deadline_misses;
+
+	// Where each entity last ran, hashed by entity address, and how often entities have changed CPU.
+	EntityTable<Placement> _placements_by_entity;
+
+	// The entity most recently picked on each CPU.
+	SchedulingEntity *_running[MAX_CPUS];
+	uint64_t _migrations;
+	uint64_t _placements;
+
+	// The number of timeslices handed over with yield_to().
+	uint64_t _directed_yields;
 };
 
+RoundRobinScheduler *RoundRobinScheduler::active;
+
+bool sched_set_deadline(SchedulingEntity& entity, SchedulingEntity::EntityRuntime runtime,
+		SchedulingEntity::EntityRuntime deadline, SchedulingEntity::EntityRuntime period)
+{
+	return RoundRobinScheduler::active && RoundRobinScheduler::active->set_deadline(entity, runtime, deadline, period);
+}
+
+bool sched_clear_deadline(SchedulingEntity& entity)
+{
+	if (!RoundRobinScheduler::active) {
+		return false;
+	}
+
+	RoundRobinScheduler::active->clear_deadline(entity);
+	return true;
+}
+
+uint64_t sched_deadline_misses(SchedulingEntity& entity)
+{
+	return RoundRobinScheduler::active ? RoundRobinScheduler::active->deadline_misses(entity) : 0;
+}
+
+bool sched_yield_to(SchedulingEntity& target)
+{
+	return RoundRobinScheduler::active && RoundRobinScheduler::active->yield_to(target);
+}
+
+bool sched_next_preemption(SchedulingEntity::EntityRuntime& until)
+{
+	if (!RoundRobinScheduler::active) {
+		return false;
+	}
+
+	until = RoundRobinScheduler::active->next_preemption();
+	return true;
+}
+
 /* --- DO NOT CHANGE ANYTHING BELOW THIS LINE --- */
 
 RegisterScheduler(RoundRobinScheduler);
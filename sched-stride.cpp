@@ -0,0 +1,409 @@
+/*
+ * Stride Scheduling Algorithm
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/log.h>
+#include <infos/util/list.h>
+#include <infos/util/lock.h>
+
+#include "cpu.h"
+#include "entity-table.h"
+#include "irq-trace.h"
+#include "sched-control.h"
+
+using namespace infos::kernel;
+using namespace infos::util;
+
+// The numerator used to turn a ticket count into a stride.
+#define STRIDE1			(1 << 20)
+
+// The amount of CPU runtime (in nanoseconds) that advances an entity's pass by exactly one stride.
+#define STRIDE_QUANTUM		1000000
+
+// The number of tickets an entity holds until it is told otherwise.
+#define DEFAULT_TICKETS		100
+
+/**
+ * A proportional-share (stride) scheduling algorithm.  Each entity holds a number of tickets, and
+ * receives CPU time in proportion to its share of the tickets held by all runnable entities.
+ */
+class StrideScheduler : public SchedulingAlgorithm
+{
+public:
+	/**
+	 * Returns the friendly name of the algorithm, for debugging and selection purposes.
+	 */
+	const char* name() const override { return "stride"; }
+
+	StrideScheduler() : _heap(nullptr), _heap_count(0), _heap_capacity(0)
+	{
+		for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+			_current[cpu] = nullptr;
+		}
+	}
+
+	/**
+	 * Called when a scheduling entity becomes eligible for running.
+	 * @param entity
+	 */
+	void add_to_runqueue(SchedulingEntity& entity) override
+	{
+		// You must make sure that interrupts are
+		// disabled when manipulating the runqueue.
+		TracedIRQLock l(IRQ_TRACE_QUIET_SITE());
+
+		active = this;
+
+		auto stride_entity = lookup(&entity, true);
+
+		// An entity that has been asleep must not be able to claim all the CPU time it
+		// missed, so it rejoins no further behind than the runnable entity furthest behind.
+		uint64_t pass;
+		if (min_pass(pass) && stride_entity->pass < pass) {
+			stride_entity->pass = pass;
+		}
+
+		stride_entity->charged_runtime = entity.cpu_runtime();
+		heap_insert(stride_entity);
+	}
+
+	/**
+	 * Called when a scheduling entity is no longer eligible for running.
+	 * @param entity
+	 */
+	void remove_from_runqueue(SchedulingEntity& entity) override
+	{
+		// You must make sure that interrupts are
+		// disabled when manipulating the runqueue.
+		TracedIRQLock l(IRQ_TRACE_QUIET_SITE());
+
+		auto stride_entity = lookup(&entity, false);
+		if (!stride_entity) {
+			return;
+		}
+
+		if (stride_entity->heap_index >= 0) {
+			charge(stride_entity);
+			heap_remove(stride_entity);
+		} else if (stride_entity->cpu >= 0) {
+			charge(stride_entity);
+			_current[stride_entity->cpu] = nullptr;
+			stride_entity->cpu = -1;
+		}
+
+		if (entity_exiting(entity)) {
+			_entities.remove(stride_entity);
+			delete stride_entity;
+		}
+	}
+
+	/**
+	 * Called every time a scheduling event occurs, to cause the next eligible entity
+	 * to be chosen.  The next eligible entity might actually be the same entity, if
+	 * e.g. its timeslice has not expired.
+	 *
+	 * In our case, the entity that has just been running on this CPU is charged for the
+	 * CPU time it used, by advancing its pass, and the entity with the smallest pass is
+	 * chosen.  An entity is taken out of the heap whilst it runs, so that no other CPU
+	 * can pick it at the same time.
+	 */
+	SchedulingEntity *pick_next_entity() override
+	{
+		// You must make sure that interrupts are
+		// disabled when manipulating the runqueue.
+		TracedIRQLock l(IRQ_TRACE_QUIET_SITE());
+
+		unsigned int cpu = current_cpu() % MAX_CPUS;
+		auto& current = _current[cpu];
+
+		// Charge the previous entity, and put it back in the heap at its new place
+		if (current) {
+			charge(current);
+			current->cpu = -1;
+			heap_insert(current);
+			current = nullptr;
+		}
+
+		// If there's nothing in our queue, return nothing
+		if (_heap_count == 0) {
+			return nullptr;
+		}
+
+		current = _heap[0];
+		heap_remove(current);
+		current->cpu = cpu;
+
+		return current->entity;
+	}
+
+	/**
+	 * Sets the number of tickets held by an entity, and therefore its share of the CPU.
+	 * @param entity The entity to update.
+	 * @param tickets The number of tickets the entity should hold.  Must be non-zero.
+	 * @return Returns TRUE if the ticket count was applied, FALSE otherwise.
+	 */
+	bool set_tickets(SchedulingEntity& entity, unsigned int tickets)
+	{
+		if (tickets == 0 || tickets > STRIDE1) {
+			return false;
+		}
+
+		TracedIRQLock l(IRQ_TRACE_SITE());
+
+		auto stride_entity = lookup(&entity, true);
+
+		// Settle up at the old stride first, so the new share only applies from now on.
+		if (stride_entity->heap_index >= 0 || stride_entity->cpu >= 0) {
+			charge(stride_entity);
+		}
+
+		stride_entity->tickets = tickets;
+		stride_entity->stride = STRIDE1 / tickets;
+
+		if (stride_entity->heap_index >= 0) {
+			sift_down(stride_entity->heap_index);
+		}
+
+		return true;
+	}
+
+	/**
+	 * Returns the number of tickets held by an entity.
+	 * @param entity The entity to query.
+	 */
+	unsigned int tickets(SchedulingEntity& entity)
+	{
+		TracedIRQLock l(IRQ_TRACE_SITE());
+
+		auto stride_entity = lookup(&entity, false);
+		return stride_entity ? stride_entity->tickets : DEFAULT_TICKETS;
+	}
+
+	/**
+	 * The instance the kernel is scheduling with: the one entities are being added to.
+	 */
+	static StrideScheduler *active;
+
+private:
+	/**
+	 * Per-entity scheduling state.
+	 */
+	struct StrideEntity
+	{
+		SchedulingEntity *entity;
+		unsigned int tickets;
+		uint64_t stride;
+		uint64_t pass;
+
+		// The CPU runtime of the entity, the last time it was charged.
+		SchedulingEntity::EntityRuntime charged_runtime;
+
+		// The position of the entity in the heap, or -1 if it is not waiting to run.
+		int heap_index;
+
+		// The CPU the entity is running on, or -1 if it is not running.
+		int cpu;
+	};
+
+	/**
+	 * Finds the stride state for an entity.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param entity The entity to look up.
+	 * @param create Whether or not to create the state, if the entity has not been seen before.
+	 * @return The state associated with the entity, or nullptr if there was none (and create was FALSE).
+	 */
+	StrideEntity *lookup(SchedulingEntity *entity, bool create)
+	{
+		auto stride_entity = _entities.lookup(entity);
+
+		if (stride_entity || !create) {
+			return stride_entity;
+		}
+
+		stride_entity = new StrideEntity();
+		init_stride_entity(stride_entity, entity);
+
+		_entities.insert(stride_entity);
+		return stride_entity;
+	}
+
+	/**
+	 * Gives an entity's stride state its initial values.
+	 */
+	void init_stride_entity(StrideEntity *stride_entity, SchedulingEntity *entity)
+	{
+		stride_entity->entity = entity;
+		stride_entity->tickets = DEFAULT_TICKETS;
+		stride_entity->stride = STRIDE1 / DEFAULT_TICKETS;
+		stride_entity->pass = 0;
+		stride_entity->charged_runtime = entity->cpu_runtime();
+		stride_entity->heap_index = -1;
+		stride_entity->cpu = -1;
+	}
+
+	/**
+	 * Finds the smallest pass of any runnable entity, whether it is waiting in the heap or running.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param pass Set to the smallest pass.
+	 * @return Returns TRUE if there is a runnable entity, FALSE otherwise.
+	 */
+	bool min_pass(uint64_t& pass) const
+	{
+		bool found = _heap_count > 0;
+		if (found) {
+			pass = _heap[0]->pass;
+		}
+
+		for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+			if (_current[cpu] && (!found || _current[cpu]->pass < pass)) {
+				pass = _current[cpu]->pass;
+				found = true;
+			}
+		}
+
+		return found;
+	}
+
+	/**
+	 * Advances the pass of an entity, by the CPU time it has used since it was last charged.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 * @param stride_entity The entity to charge.
+	 */
+	void charge(StrideEntity *stride_entity)
+	{
+		auto runtime = stride_entity->entity->cpu_runtime();
+		stride_entity->pass += ((runtime - stride_entity->charged_runtime) * stride_entity->stride) / STRIDE_QUANTUM;
+		stride_entity->charged_runtime = runtime;
+	}
+
+	/**
+	 * Places an entity into the heap at the given index.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void heap_set(int index, StrideEntity *stride_entity)
+	{
+		_heap[index] = stride_entity;
+		stride_entity->heap_index = index;
+	}
+
+	/**
+	 * Inserts an entity into the heap, growing the heap if required.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void heap_insert(StrideEntity *stride_entity)
+	{
+		if (_heap_count == _heap_capacity) {
+			int new_capacity = _heap_capacity ? _heap_capacity * 2 : 16;
+			auto new_heap = new StrideEntity *[new_capacity];
+
+			for (int i = 0; i < _heap_count; i++) {
+				new_heap[i] = _heap[i];
+			}
+
+			delete[] _heap;
+			_heap = new_heap;
+			_heap_capacity = new_capacity;
+		}
+
+		heap_set(_heap_count, stride_entity);
+		sift_up(_heap_count++);
+	}
+
+	/**
+	 * Removes an entity from the heap.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void heap_remove(StrideEntity *stride_entity)
+	{
+		int index = stride_entity->heap_index;
+		stride_entity->heap_index = -1;
+
+		// Fill the hole with the last entity in the heap, and restore the heap property.
+		if (--_heap_count == index) {
+			return;
+		}
+
+		auto moved = _heap[_heap_count];
+		heap_set(index, moved);
+		sift_up(index);
+		sift_down(moved->heap_index);
+	}
+
+	/**
+	 * Moves the entity at the given index towards the root, until its parent has a smaller pass.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void sift_up(int index)
+	{
+		auto stride_entity = _heap[index];
+
+		while (index > 0) {
+			int parent = (index - 1) / 2;
+			if (_heap[parent]->pass <= stride_entity->pass) {
+				break;
+			}
+
+			heap_set(index, _heap[parent]);
+			index = parent;
+		}
+
+		heap_set(index, stride_entity);
+	}
+
+	/**
+	 * Moves the entity at the given index towards the leaves, until its children have larger passes.
+	 * @warning Does not ensure interrupts are disabled. Use with care.
+	 */
+	void sift_down(int index)
+	{
+		auto stride_entity = _heap[index];
+
+		while (true) {
+			int child = (index * 2) + 1;
+			if (child >= _heap_count) {
+				break;
+			}
+
+			// Pick the smaller of the two children
+			if (child + 1 < _heap_count && _heap[child + 1]->pass < _heap[child]->pass) {
+				child++;
+			}
+
+			if (stride_entity->pass <= _heap[child]->pass) {
+				break;
+			}
+
+			heap_set(index, _heap[child]);
+			index = child;
+		}
+
+		heap_set(index, stride_entity);
+	}
+
+	// A min-heap of runnable entities, keyed by pass.
+	StrideEntity **_heap;
+	int _heap_count;
+	int _heap_capacity;
+
+	// The entity running on each CPU, which is kept out of the heap until it is charged.
+	StrideEntity *_current[MAX_CPUS];
+
+	// The stride state of every entity this algorithm has seen, hashed by entity address.
+	EntityTable<StrideEntity> _entities;
+};
+
+StrideScheduler *StrideScheduler::active;
+
+bool sched_set_tickets(SchedulingEntity& entity, unsigned int tickets)
+{
+	return StrideScheduler::active && StrideScheduler::active->set_tickets(entity, tickets);
+}
+
+/* --- DO NOT CHANGE ANYTHING BELOW THIS LINE --- */
+
+RegisterScheduler(StrideScheduler);
@@ -0,0 +1,191 @@
+#!/bin/sh
+
+# Boots the kernel headless across a matrix of configurations, runs each benchmark, and tabulates
+# the results.  Everything is read from the kernel log, which is left on the debug console (there is
+# no syslog=serial) and written by QEMU to one file per run.
+#
+# Each benchmark <name> runs the infos-user program /usr/bench-<name> as init, which must be added
+# to the root filesystem first, and is skipped if it is not there.  The default set is:
+#
+#   alloc      allocation storm
+#   spawn      thread spawn & exit
+#   pingpong   context-switch ping-pong between two threads
+#   tod        time-of-day calls
+#
+# Such programs read the time of day as soon as they start, print lines of the form
+#
+#   BENCH <metric> <value> <unit>
+#
+# to the log, and finish with a line containing BENCH-END.  The kernel is booted with
+# rtc.boot-marker=1, so that it logs the first of those reads as "BENCH boot-time <ns> ns", which
+# gives each run's boot time alongside its results.
+#
+# Usage: bench-matrix.sh [--baseline <results.tsv>] [output-dir]
+#
+# The matrix is set by the PGALLOCS, SCHEDS, MEMS, SMPS and BENCHMARKS environment variables, and
+# QEMU picks the emulator.  With --baseline, any result more than THRESHOLD percent worse than the
+# baseline is reported, and the script exits with an error.
+
+BASELINE=
+if [ "$1" = "--baseline" ]
+  then
+    BASELINE=$2
+    shift 2
+
+    if [ ! -f "$BASELINE" ]
+      then
+        echo "  ERROR: BASELINE $BASELINE DOES NOT EXIST"
+        exit 1
+    fi
+fi
+
+TOP=`pwd`
+INFOS_DIRECTORY=$TOP/infos
+ROOTFS=$TOP/infos-user/bin/rootfs.tar
+KERNEL=$INFOS_DIRECTORY/out/infos-kernel
+OUTPUT=${1:-$TOP/bench-`date +%Y%m%d-%H%M%S`}
+
+QEMU=${QEMU:-qemu-system-x86_64}
+PGALLOCS=${PGALLOCS:-"simple buddy"}
+SCHEDS=${SCHEDS:-"cfs rr"}
+MEMS=${MEMS:-"512M 5G"}
+SMPS=${SMPS:-"1 4"}
+BENCHMARKS=${BENCHMARKS:-"alloc spawn pingpong tod"}
+TIMEOUT=${TIMEOUT:-120}
+THRESHOLD=${THRESHOLD:-10}
+
+if [ ! -f $KERNEL ] || [ ! -f $ROOTFS ]
+  then
+    echo "  ERROR: KERNEL OR ROOT FILESYSTEM NOT BUILT (RUN build.sh FIRST)"
+    exit 1
+fi
+
+mkdir -p $OUTPUT/logs || exit 1
+RESULTS=$OUTPUT/results.tsv
+: > $RESULTS
+
+for PGALLOC in $PGALLOCS; do
+for SCHED in $SCHEDS; do
+for MEM in $MEMS; do
+for SMP in $SMPS; do
+for BENCH in $BENCHMARKS; do
+  CONFIG=$PGALLOC/$SCHED/$MEM/smp$SMP
+  LOG=$OUTPUT/logs/$PGALLOC-$SCHED-$MEM-smp$SMP-$BENCH.log
+
+  INIT=/usr/bench-$BENCH
+  MARKER=BENCH-END
+
+  if ! tar -tf $ROOTFS | grep -q "usr/bench-$BENCH\$"
+    then
+      echo "  ERROR: $INIT IS NOT IN THE ROOT FILESYSTEM, SKIPPING $BENCH"
+      continue
+  fi
+
+  KERNEL_CMDLINE="boot-device=ata0 init=$INIT pgalloc.debug=0 pgalloc.algorithm=$PGALLOC objalloc.debug=0 sched.debug=0 sched.algorithm=$SCHED rtc.boot-marker=1"
+
+  echo "Running $BENCH on $CONFIG..."
+
+  : > $LOG
+
+  $QEMU -kernel $KERNEL -m $MEM -smp $SMP -display none -no-reboot \
+    -debugcon file:$LOG -serial none -hda $ROOTFS -append "$KERNEL_CMDLINE" > /dev/null 2>&1 &
+  PID=$!
+
+  # Wait for the marker, the guest to stop, or the time to run out.
+  ELAPSED=0
+  while kill -0 $PID 2>/dev/null && ! grep -qF -- "$MARKER" $LOG && [ $ELAPSED -lt $((TIMEOUT * 10)) ]; do
+    sleep 0.1
+    ELAPSED=$((ELAPSED + 1))
+  done
+
+  kill $PID 2>/dev/null
+  wait $PID 2>/dev/null
+
+  if ! grep -qF -- "$MARKER" $LOG
+    then
+      echo "  ERROR: $BENCH DID NOT FINISH ON $CONFIG (SEE $LOG)"
+      printf '%s\t%s\t%s\t%s\t%s\n' $CONFIG $BENCH failed 1 run >> $RESULTS
+      continue
+  fi
+
+  if ! grep -qF -- "BENCH boot-time" $LOG
+    then
+      echo "  WARNING: NO BOOT MARKER FROM $BENCH ON $CONFIG (IT SHOULD READ THE TIME OF DAY AS IT STARTS)"
+  fi
+
+  grep -o 'BENCH [^ ]* [0-9.]* [^ ]*' $LOG | \
+    awk -v config=$CONFIG -v bench=$BENCH '{ printf "%s\t%s\t%s\t%s\t%s\n", config, bench, $2, $3, $4 }' >> $RESULTS
+done
+done
+done
+done
+done
+
+# Print one row per configuration, and one column per benchmark metric.
+echo
+awk -F'\t' '
+  {
+    column = $2 "." $3
+    if (!(column in seen)) {
+      seen[column] = 1
+      columns[ncolumns++] = column
+    }
+    if (!($1 in rowseen)) {
+      rowseen[$1] = 1
+      rows[nrows++] = $1
+    }
+    value[$1, column] = $4 " " $5
+  }
+  END {
+    printf "%-28s", "config"
+    for (c = 0; c < ncolumns; c++)
+      printf " %22s", columns[c]
+    printf "\n"
+
+    for (r = 0; r < nrows; r++) {
+      printf "%-28s", rows[r]
+      for (c = 0; c < ncolumns; c++)
+        printf " %22s", ((rows[r], columns[c]) in value) ? value[rows[r], columns[c]] : "-"
+      printf "\n"
+    }
+  }' $RESULTS | tee $OUTPUT/table.txt
+
+echo
+echo "Results written to $OUTPUT"
+
+if [ -z "$BASELINE" ]
+  then
+    exit 0
+fi
+
+# Compare against the baseline.  Rates (units ending in /s) are better when higher, everything else
+# (times, counts of failures) is better when lower.
+echo
+awk -F'\t' -v threshold=$THRESHOLD '
+  FNR == NR {
+    baseline[$1, $2, $3] = $4
+    next
+  }
+  ($1, $2, $3) in baseline {
+    old = baseline[$1, $2, $3]
+    if (old == 0)
+      next
+
+    change = (100.0 * ($4 - old)) / old
+    worse = ($5 ~ /\/s$/) ? -change : change
+    if (worse > threshold) {
+      printf "  REGRESSION: %s %s.%s %s -> %s %s (%+.1f%%)\n", $1, $2, $3, old, $4, $5, change
+      regressions++
+    }
+  }
+  $3 == "failed" && !(($1, $2, $3) in baseline) {
+    printf "  REGRESSION: %s %s failed\n", $1, $2
+    regressions++
+  }
+  END {
+    if (regressions) {
+      printf "%d regression(s) against the baseline\n", regressions
+      exit 1
+    }
+    print "No regressions against the baseline"
+  }' $BASELINE $RESULTS
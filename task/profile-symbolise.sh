@@ -0,0 +1,63 @@
+#!/bin/sh
+
+# Turns the PROF lines written by the CMOS RTC profiler (rtc.profile=<hz>) into a flat profile,
+# or into folded stacks for flamegraph.pl.
+#
+# Usage: profile-symbolise.sh [--folded] <kernel-elf> <serial-log>
+
+FOLDED=0
+if [ "$1" = "--folded" ]
+  then
+    FOLDED=1
+    shift
+fi
+
+KERNEL=$1
+LOG=$2
+
+if [ ! -f "$KERNEL" ] || [ ! -f "$LOG" ]
+  then
+    echo "usage: $0 [--folded] <kernel-elf> <serial-log>"
+    exit 1
+fi
+
+TMPDIR=`mktemp -d`
+trap "rm -rf $TMPDIR" EXIT
+
+# Pull out "cpu thread rip" for every sample.
+grep -o 'PROF [0-9]* [0-9a-fx]* [0-9a-f]*' "$LOG" | cut -d' ' -f2- > $TMPDIR/samples
+
+if [ ! -s $TMPDIR/samples ]
+  then
+    echo "  ERROR: NO PROFILE SAMPLES FOUND IN $LOG"
+    exit 1
+fi
+
+# Symbolise each distinct address once.
+cut -d' ' -f3 $TMPDIR/samples | sort -u > $TMPDIR/addrs
+sed 's/^/0x/' $TMPDIR/addrs | addr2line -f -C -e "$KERNEL" | paste - - | cut -f1 | paste -d' ' $TMPDIR/addrs - > $TMPDIR/symbols
+
+# Count the samples, either per function (a flat profile), or per cpu;thread;function (folded
+# stacks, ready for flamegraph.pl).
+awk -v symbols=$TMPDIR/symbols -v folded=$FOLDED '
+  BEGIN {
+    while ((getline line < symbols) > 0) {
+      addr = line
+      sub(/ .*/, "", addr)
+      sub(/^[^ ]* /, "", line)
+      sym[addr] = line
+    }
+  }
+  {
+    key = folded ? "cpu" $1 ";" $2 ";" sym[$3] : sym[$3]
+    count[key]++
+    total++
+  }
+  END {
+    for (k in count) {
+      if (folded)
+        print k, count[k]
+      else
+        printf "%8d %6.2f%%  %s\n", count[k], (100.0 * count[k]) / total, k
+    }
+  }' $TMPDIR/samples | sort -rn
@@ -0,0 +1,96 @@
+/*
+ * Measures what spawning and exiting threads costs the buddy page allocator: host time per spawn and
+ * exit, with each thread's stack taken from the stack cache, and with the stack cache disabled.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test.h"
+#include "host-cpu.h"
+#include "../buddy.cpp"
+
+// How many pages the allocator is given: two maximum-order blocks.
+#define TEST_PAGES		(2 * (1ULL << MAX_ORDER))
+
+// How many threads are alive at once, and how many are spawned (and exit) in each measurement.
+#define LIVE_THREADS		64
+#define SPAWNS			1000000
+
+static uint64_t host_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Spawns and exits threads, oldest first, keeping LIVE_THREADS alive.  Each thread has a stack, and a
+ * page of its own (e.g. for its thread control block) allocated alongside, as the kernel's thread code
+ * does.
+ * @return Returns the host time taken per spawn and exit, in nanoseconds.
+ */
+static double spawn_exit(BuddyPageAllocator *allocator)
+{
+	PageDescriptor *stacks[LIVE_THREADS];
+	PageDescriptor *pages[LIVE_THREADS];
+
+	for (unsigned int i = 0; i < LIVE_THREADS; i++) {
+		stacks[i] = pgalloc_alloc_stack();
+		pages[i] = allocator->alloc_pages(0);
+	}
+
+	uint64_t start = host_ns();
+
+	for (unsigned int i = 0; i < SPAWNS; i++) {
+		unsigned int oldest = i % LIVE_THREADS;
+
+		pgalloc_free_stack(stacks[oldest]);
+		allocator->free_pages(pages[oldest], 0);
+
+		stacks[oldest] = pgalloc_alloc_stack();
+		pages[oldest] = allocator->alloc_pages(0);
+	}
+
+	uint64_t host_time = host_ns() - start;
+
+	for (unsigned int i = 0; i < LIVE_THREADS; i++) {
+		pgalloc_free_stack(stacks[i]);
+		allocator->free_pages(pages[i], 0);
+	}
+
+	return host_time / (double)SPAWNS;
+}
+
+int main()
+{
+	auto page_descriptors = (PageDescriptor *)calloc(TEST_PAGES, sizeof(PageDescriptor));
+	auto memory = calloc(TEST_PAGES, 1 << PAGE_BITS);
+	sys.mm().pgalloc().set_memory(page_descriptors, memory);
+
+	// With the stack cache, every stack after the first few is reused from it.
+	auto allocator = new BuddyPageAllocator();
+	allocator->init(page_descriptors, TEST_PAGES);
+
+	double cached = spawn_exit(allocator);
+	printf("  %-24s %.1f ns of host time\n", "spawn & exit (cached)", cached);
+	CHECK(allocator->stack_cache_hits() >= SPAWNS);
+
+	delete allocator;
+
+	// Without it, every stack is split from a larger block, and coalesced again on exit.
+	memset(page_descriptors, 0, TEST_PAGES * sizeof(PageDescriptor));
+	stack_cache_size = 0;
+
+	allocator = new BuddyPageAllocator();
+	allocator->init(page_descriptors, TEST_PAGES);
+
+	double uncached = spawn_exit(allocator);
+	printf("  %-24s %.1f ns of host time\n", "spawn & exit (uncached)", uncached);
+	CHECK(allocator->stack_cache_hits() == 0);
+
+	delete allocator;
+
+	return TEST_RESULT();
+}
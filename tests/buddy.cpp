@@ -0,0 +1,363 @@
+/*
+ * Checks the buddy page allocator, over memory allocated on the host: reporting free pages to the
+ * hypervisor, NUMA nodes, the thread stack cache, shared pages, and same-page merging.
+ */
+#include <stdlib.h>
+
+#include "test.h"
+#include "host-cpu.h"
+#include "../buddy.cpp"
+
+// How many pages each test gives the allocator: two maximum-order blocks.
+#define TEST_PAGES		(2 * (1ULL << MAX_ORDER))
+
+// The number of pages in a reporting-order chunk.
+#define CHUNK_PAGES		(1ULL << REPORTING_ORDER)
+
+/**
+ * Creates an allocator, and gives it the given number of pages of fresh memory.
+ */
+static BuddyPageAllocator *create_allocator(uint64_t pages)
+{
+	auto page_descriptors = (PageDescriptor *)calloc(pages, sizeof(PageDescriptor));
+	auto memory = calloc(pages, 1 << PAGE_BITS);
+	sys.mm().pgalloc().set_memory(page_descriptors, memory);
+
+	auto allocator = new BuddyPageAllocator();
+	allocator->init(page_descriptors, pages);
+
+	return allocator;
+}
+
+// What the hypervisor has been told: whether each chunk is free, and how many times it was reported.
+static bool host_free[TEST_PAGES / CHUNK_PAGES];
+static unsigned int reports;
+static unsigned int rereports;
+
+static void host_report(PageDescriptor *pgd, int order, void *priv)
+{
+	uint64_t pfn = sys.mm().pgalloc().pgd_to_pfn(pgd);
+
+	for (uint64_t chunk = pfn / CHUNK_PAGES; chunk < (pfn + (1ULL << order)) / CHUNK_PAGES; chunk++) {
+		if (host_free[chunk]) {
+			rereports++;
+		}
+
+		host_free[chunk] = true;
+	}
+
+	reports++;
+}
+
+/**
+ * Memory is only reported once, from report_free_pages() and never from free_pages(), and stays
+ * reported when a block is split to allocate from it.  Chunks that were allocated are reported again
+ * once they are free, and only they are.
+ */
+static void test_reporting()
+{
+	auto allocator = create_allocator(TEST_PAGES);
+	pgalloc_set_free_page_reporter(host_report, nullptr);
+
+	// The two maximum-order blocks, whole.
+	CHECK(pgalloc_report_free_pages() == TEST_PAGES);
+	CHECK(reports == 2);
+
+	// Splitting a reported block to allocate a page leaves the rest of it reported.
+	auto page = allocator->alloc_pages(0);
+	host_free[sys.mm().pgalloc().pgd_to_pfn(page) / CHUNK_PAGES] = false;
+
+	allocator->free_pages(page, 0);
+	CHECK(pgalloc_report_free_pages() == 0);
+	CHECK(reports == 2);
+
+	// Freeing a lot of memory does not report it, but the next call does.  The first block allocated
+	// is the chunk the page came from.
+	PageDescriptor *blocks[32];
+	for (unsigned int i = 0; i < 32; i++) {
+		blocks[i] = allocator->alloc_pages(REPORTING_ORDER);
+		host_free[sys.mm().pgalloc().pgd_to_pfn(blocks[i]) / CHUNK_PAGES] = false;
+	}
+
+	for (unsigned int i = 0; i < 32; i++) {
+		allocator->free_pages(blocks[i], REPORTING_ORDER);
+	}
+
+	CHECK(reports == 2);
+	CHECK(pgalloc_report_free_pages() == 32 * CHUNK_PAGES);
+	CHECK(reports == 2 + 32);
+	CHECK(rereports == 0);
+
+	for (uint64_t chunk = 0; chunk < TEST_PAGES / CHUNK_PAGES; chunk++) {
+		CHECK(host_free[chunk]);
+	}
+
+	// Everything was merged back together in the end.
+	CHECK(allocator->alloc_pages(MAX_ORDER) != nullptr);
+	CHECK(allocator->alloc_pages(MAX_ORDER) != nullptr);
+	CHECK(allocator->alloc_pages(0) == nullptr);
+
+	delete allocator;
+}
+
+/**
+ * Nodes start where the command line says, even off any block boundary, and blocks never straddle
+ * two nodes.  Each CPU allocates from its own node first, and then from the nearest.
+ */
+static void test_numa()
+{
+	// Node 1 starts 96MiB in, part of the way through the first maximum-order block.
+	__cmdline_PgAllocNUMAMem("0,96");
+	__cmdline_PgAllocNUMACPUs("1,0");
+	__cmdline_PgAllocNUMADistance("10,20,20,10");
+
+	auto allocator = create_allocator(TEST_PAGES);
+	CHECK(allocator->nr_nodes() == 2);
+
+	uint64_t boundary = (96 << 20) >> PAGE_BITS;
+
+	test_cpu = 0;
+	auto page = allocator->alloc_pages(0);
+	CHECK(sys.mm().pgalloc().pgd_to_pfn(page) >= boundary);
+	allocator->free_pages(page, 0);
+
+	// Node 0 is 64MiB and 32MiB blocks.
+	test_cpu = 1;
+	auto first = allocator->alloc_pages(14);
+	auto second = allocator->alloc_pages(13);
+	CHECK(first && sys.mm().pgalloc().pgd_to_pfn(first) < boundary);
+	CHECK(second && sys.mm().pgalloc().pgd_to_pfn(second) < boundary);
+	CHECK(allocator->node_hits(0) == 2);
+
+	page = allocator->alloc_pages(0);
+	CHECK(sys.mm().pgalloc().pgd_to_pfn(page) >= boundary);
+	CHECK(allocator->node_misses(0) == 1);
+
+	// An explicit node is honoured whichever CPU asks.
+	auto remote = pgalloc_alloc_pages_node(1, 0);
+	CHECK(sys.mm().pgalloc().pgd_to_pfn(remote) >= boundary);
+	CHECK(allocator->node_hits(1) == 2);
+
+	allocator->free_pages(remote, 0);
+	allocator->free_pages(page, 0);
+	allocator->free_pages(second, 13);
+	allocator->free_pages(first, 14);
+
+	// Only the second maximum-order block lies entirely within one node.
+	CHECK(allocator->alloc_pages(MAX_ORDER) != nullptr);
+	CHECK(allocator->alloc_pages(MAX_ORDER) == nullptr);
+
+	delete allocator;
+
+	test_cpu = 0;
+	numa_nodes = 1;
+	numa_cpus = 0;
+	numa_distances = 0;
+}
+
+/**
+ * Only stacks are cached, never other blocks of the same order, and the caches are given back as soon
+ * as memory runs low, before any allocation has had to fail.
+ */
+static void test_stack_cache()
+{
+	auto allocator = create_allocator(TEST_PAGES);
+
+	// A stack is reused by the next thread.
+	auto stack = pgalloc_alloc_stack();
+	CHECK(pgalloc_free_stack(stack));
+	CHECK(pgalloc_alloc_stack() == stack);
+	CHECK(allocator->stack_cache_hits() == 1);
+
+	// Other allocations of the same size are neither cached nor served from the cache.
+	auto block = allocator->alloc_pages(STACK_CACHE_ORDER);
+	allocator->free_pages(block, STACK_CACHE_ORDER);
+	pgalloc_free_stack(stack);
+	CHECK(allocator->alloc_pages(STACK_CACHE_ORDER) == block);
+	CHECK(allocator->stack_cache_hits() == 1);
+	allocator->free_pages(block, STACK_CACHE_ORDER);
+
+	// Use up the memory down to just above the watermark, and the cached stack stays cached.
+	uint64_t low = TEST_PAGES / LOW_WATERMARK_FRACTION;
+	uint64_t to_use = TEST_PAGES - (1ULL << STACK_CACHE_ORDER) - low - (1ULL << STACK_CACHE_ORDER);
+
+	for (int order = MAX_ORDER; order >= 0; order--) {
+		while (to_use >= (1ULL << order)) {
+			CHECK(allocator->alloc_pages(order) != nullptr);
+			to_use -= 1ULL << order;
+		}
+	}
+
+	CHECK(allocator->stack_cache_drains() == 0);
+
+	// The allocation that takes memory below the watermark succeeds, and drains the cache.
+	auto last = allocator->alloc_pages(STACK_CACHE_ORDER + 1);
+	CHECK(last != nullptr);
+	CHECK(allocator->stack_cache_drains() == 1);
+
+	// While memory is low, freed stacks go straight back to the free lists.
+	stack = pgalloc_alloc_stack();
+	pgalloc_free_stack(stack);
+	CHECK(allocator->alloc_pages(STACK_CACHE_ORDER) == stack);
+	CHECK(allocator->stack_cache_hits() == 1);
+
+	delete allocator;
+}
+
+// Which pages count_free_pages() has been handed.
+static bool handed_out[TEST_PAGES];
+
+/**
+ * Counts the free pages by allocating every one of them, checking that none is handed out twice or is
+ * the given page, and frees them all again.
+ */
+static uint64_t count_free_pages(BuddyPageAllocator *allocator, PageDescriptor *absent)
+{
+	static PageDescriptor *pages[TEST_PAGES];
+	uint64_t count = 0;
+
+	while ((pages[count] = allocator->alloc_pages(0))) {
+		uint64_t pfn = sys.mm().pgalloc().pgd_to_pfn(pages[count]);
+
+		CHECK(!handed_out[pfn] && pages[count] != absent);
+		handed_out[pfn] = true;
+		count++;
+	}
+
+	for (uint64_t i = 0; i < count; i++) {
+		handed_out[sys.mm().pgalloc().pgd_to_pfn(pages[i])] = false;
+		allocator->free_pages(pages[i], 0);
+	}
+
+	return count;
+}
+
+/**
+ * A page shared out of a larger block stays allocated until both the block and the page have been
+ * freed, in either order, and is only freed once.
+ */
+static void test_shared_pages()
+{
+	auto allocator = create_allocator(TEST_PAGES);
+
+	// The owner frees the block first, then the page is dropped.
+	auto block = allocator->alloc_pages(2);
+	CHECK(pgalloc_get_page(block + 1));
+	CHECK(allocator->page_refcount(block + 1) == 2);
+
+	uint64_t free = count_free_pages(allocator, block + 1);
+
+	allocator->free_pages(block, 2);
+	CHECK(allocator->page_refcount(block + 1) == 1);
+	CHECK(count_free_pages(allocator, block + 1) == free + 3);
+
+	allocator->free_pages(block + 1, 0);
+	CHECK(count_free_pages(allocator, nullptr) == free + 4);
+
+	// The page is dropped first, then the owner frees the block.
+	block = allocator->alloc_pages(2);
+	CHECK(pgalloc_get_page(block + 3));
+
+	allocator->free_pages(block + 3, 0);
+	CHECK(allocator->page_refcount(block + 3) == 1);
+	CHECK(count_free_pages(allocator, block + 3) == free);
+
+	allocator->free_pages(block, 2);
+	CHECK(count_free_pages(allocator, nullptr) == free + 4);
+
+	// Everything but the reference counts coalesced again.
+	CHECK(allocator->alloc_pages(MAX_ORDER) != nullptr);
+	CHECK(allocator->alloc_pages(MAX_ORDER) == nullptr);
+
+	delete allocator;
+}
+
+/**
+ * Fills a page with the given value, word by word.
+ */
+static void fill_page(PageDescriptor *pgd, uint64_t value)
+{
+	auto words = (uint64_t *)sys.mm().pgalloc().pgd_to_vpa(pgd);
+	for (unsigned int i = 0; i < (1 << PAGE_BITS) / sizeof(*words); i++) {
+		words[i] = value;
+	}
+}
+
+/**
+ * Identical pages merge into one, and zero pages into the shared zero page.  The merge table never keeps a
+ * page that nobody else refers to, and makes room for new pages by evicting old ones.
+ */
+static void test_merging()
+{
+	auto allocator = create_allocator(TEST_PAGES);
+
+	auto a = allocator->alloc_pages(0);
+	auto b = allocator->alloc_pages(0);
+	auto zero = allocator->alloc_pages(0);
+	auto other_zero = allocator->alloc_pages(0);
+	fill_page(a, 42);
+	fill_page(b, 42);
+	fill_page(zero, 0);
+	fill_page(other_zero, 0);
+
+	// The first page is kept for the second to merge into, which is then freed by its owner.
+	CHECK(pgalloc_merge_page(a) == a);
+	CHECK(pgalloc_merge_page(b) == a);
+	allocator->free_pages(b, 0);
+	CHECK(allocator->page_refcount(a) == 3);
+
+	CHECK(pgalloc_merge_page(zero) == zero);
+	CHECK(pgalloc_merge_page(other_zero) == zero);
+	allocator->free_pages(other_zero, 0);
+
+	PageMergeStats stats;
+	CHECK(pgalloc_merge_stats(stats));
+	CHECK(stats.scanned == 4 && stats.merged == 2 && stats.merged_zero == 1);
+
+	uint64_t free = count_free_pages(allocator, a);
+
+	// Once only the table refers to the page, it is freed.
+	allocator->free_pages(a, 0);
+	allocator->free_pages(a, 0);
+	CHECK(count_free_pages(allocator, nullptr) == free + 1);
+
+	// A full table evicts a page for each new one, which leaves it to its owner alone.
+	static PageDescriptor *pages[MERGE_TABLE_LIMIT + 1];
+	for (unsigned int i = 0; i < MERGE_TABLE_LIMIT + 1; i++) {
+		pages[i] = allocator->alloc_pages(0);
+		fill_page(pages[i], i + 1);
+		CHECK(pgalloc_merge_page(pages[i]) == pages[i]);
+	}
+
+	unsigned int evicted = 0;
+	for (unsigned int i = 0; i < MERGE_TABLE_LIMIT + 1; i++) {
+		if (allocator->page_refcount(pages[i]) == 1) {
+			evicted++;
+		}
+	}
+
+	CHECK(allocator->merge_evictions() == 1 && evicted == 1);
+	CHECK(allocator->page_refcount(pages[MERGE_TABLE_LIMIT]) == 2);
+
+	// Every page goes back to the free lists when its owner frees it.
+	free = count_free_pages(allocator, nullptr);
+
+	for (unsigned int i = 0; i < MERGE_TABLE_LIMIT + 1; i++) {
+		allocator->free_pages(pages[i], 0);
+	}
+
+	CHECK(count_free_pages(allocator, nullptr) == free + MERGE_TABLE_LIMIT + 1);
+
+	delete allocator;
+}
+
+int main()
+{
+	test_reporting();
+	test_numa();
+	test_stack_cache();
+	test_shared_pages();
+	test_merging();
+
+	return TEST_RESULT();
+}
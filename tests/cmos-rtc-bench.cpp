@@ -0,0 +1,103 @@
+/*
+ * Measures what reading the time costs the CMOS RTC driver, against an emulated MC146818: port I/O
+ * and (emulated) bus time per read, for a cached read, a resync and a direct interrogation of the
+ * RTC, and host time per cached read.
+ */
+#include <time.h>
+
+#include "test.h"
+#include "mc146818.h"
+#include "../cmos-rtc.cpp"
+#include "../irq-trace.cpp"
+#include "../timer-wheel.cpp"
+
+// How many reads each measurement is averaged over.
+#define READS			100000
+
+// The most port I/O an uncached read may take: two accesses for each of status registers A and B,
+// the six date & time registers and the century register.
+#define MAX_UNCACHED_IO		18
+
+static uint64_t host_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Reports the port I/O and emulated time taken by one read, and checks that the driver's own count
+ * of port I/O agrees with the RTC's.
+ */
+static void report(const char *name, MC146818& rtc, CMOSRTC& driver, uint64_t io, uint64_t driver_io, uint64_t start)
+{
+	uint64_t used = rtc.port_io_count() - io;
+
+	printf("  %-24s %3lu port I/O, %6lu ns of bus time\n", name, used, sys.runtime() - start);
+	CHECK(driver.port_io_count() - driver_io == used);
+}
+
+int main()
+{
+	MC146818 rtc;
+	rtc.set_time(2024, 6, 1, 12, 0, 0);
+	rtc.set_next_update(MC_NS_PER_SEC / 2);
+
+	DeviceManager dm;
+	auto driver = new CMOSRTC();
+	driver->init(dm);
+
+	RTCTimePoint tp;
+
+	// The first read has no cached time, so interrogates the RTC.
+	uint64_t io = rtc.port_io_count(), driver_io = driver->port_io_count(), start = sys.runtime();
+	driver->read_timepoint(tp);
+	report("first read", rtc, *driver, io, driver_io, start);
+	CHECK(rtc.port_io_count() - io <= MAX_UNCACHED_IO);
+
+	// Every read after that works from the cached time.
+	io = rtc.port_io_count();
+	driver_io = driver->port_io_count();
+	start = sys.runtime();
+	uint64_t host_start = host_ns();
+
+	for (int i = 0; i < READS; i++) {
+		driver->read_timepoint(tp);
+	}
+
+	uint64_t host_time = host_ns() - host_start;
+	report("cached read", rtc, *driver, io, driver_io, start);
+	CHECK(rtc.port_io_count() == io);
+	printf("  %-24s %.1f ns of host time\n", "cached read", host_time / (double)READS);
+
+	// Once the cached time is due a resync, one read pays for it.
+	rtc.run_for(RTC_RESYNC_INTERVAL);
+
+	io = rtc.port_io_count();
+	driver_io = driver->port_io_count();
+	start = sys.runtime();
+	driver->read_timepoint(tp);
+	report("resync", rtc, *driver, io, driver_io, start);
+	CHECK(rtc.port_io_count() - io <= MAX_UNCACHED_IO);
+
+	// Interrogating the RTC every time, as the driver used to, for comparison.
+	io = rtc.port_io_count();
+	driver_io = driver->port_io_count();
+	start = sys.runtime();
+	host_start = host_ns();
+
+	for (int i = 0; i < READS; i++) {
+		driver->read_rtc(tp);
+	}
+
+	host_time = host_ns() - host_start;
+	printf("  %-24s %.1f port I/O, %.0f ns of bus time, %.1f ns of host time\n", "direct read (each)",
+		(rtc.port_io_count() - io) / (double)READS, (sys.runtime() - start) / (double)READS, host_time / (double)READS);
+	CHECK(driver->port_io_count() - driver_io == rtc.port_io_count() - io);
+	CHECK(rtc.garbage_reads() == 0);
+
+	delete driver;
+
+	return TEST_RESULT();
+}
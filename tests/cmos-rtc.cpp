@@ -0,0 +1,405 @@
+/*
+ * Checks the CMOS RTC driver against an emulated MC146818: every register format, reads that land
+ * on an RTC update, rollovers, keeping the cached time monotonic, the alarm-driven timers, writing
+ * out the profile, and the boot marker.
+ */
+#include "test.h"
+#include "host-cpu.h"
+#include "mc146818.h"
+#include "../cmos-rtc.cpp"
+#include "../irq-trace.cpp"
+#include "../timer-wheel.cpp"
+
+/**
+ * Checks that a timepoint holds the given date & time, with a two-digit year.
+ */
+static bool same_time(const RTCTimePoint& tp, unsigned int year, unsigned int month, unsigned int day,
+		unsigned int hours, unsigned int minutes, unsigned int seconds)
+{
+	return tp.year == year % 100 && tp.month == month && tp.day_of_month == day && tp.hours == hours &&
+		tp.minutes == minutes && tp.seconds == seconds;
+}
+
+/**
+ * Checks that a timepoint matches what the emulated RTC holds right now.
+ */
+static bool same_time(const RTCTimePoint& tp, const MC146818& rtc)
+{
+	return same_time(tp, rtc.year(), rtc.month(), rtc.day(), rtc.hours(), rtc.minutes(), rtc.seconds());
+}
+
+/**
+ * Every combination of BCD or binary, and 12- or 24-hour mode, decodes to the same time, including
+ * midnight and noon, which are both "12" in 12-hour mode.
+ */
+static void test_register_formats()
+{
+	static const unsigned int hours[] = { 0, 1, 11, 12, 13, 23 };
+
+	for (int binary = 0; binary < 2; binary++) {
+		for (int twelve_hour = 0; twelve_hour < 2; twelve_hour++) {
+			for (unsigned int h : hours) {
+				MC146818 rtc;
+				rtc.set_mode(binary, twelve_hour);
+				rtc.set_time(2024, 2, 29, h, 59, 30);
+				rtc.set_next_update(MC_NS_PER_SEC / 2);
+
+				DeviceManager dm;
+				auto driver = new CMOSRTC();
+				driver->init(dm);
+
+				RTCTimePoint tp;
+				driver->read_timepoint(tp);
+
+				CHECK(same_time(tp, 2024, 2, 29, h, 59, 30));
+				CHECK(driver->century() == 20);
+
+				delete driver;
+			}
+		}
+	}
+}
+
+/**
+ * A first read that lands anywhere around an RTC update gets either the time before the update or
+ * the time after it, never a mixture, and never reads the registers whilst they are undefined.  The
+ * update chosen carries all the way into the century.
+ */
+static void test_update_boundary()
+{
+	uint64_t worst_wait = 0;
+
+	for (uint64_t offset = 1000; offset < MC_UPDATE_NS + MC_UIP_LEAD_NS + 50000; offset += 3000) {
+		for (int binary = 0; binary < 2; binary++) {
+			MC146818 rtc;
+			rtc.set_mode(binary, false);
+			rtc.set_time(2099, 12, 31, 23, 59, 59);
+			rtc.set_next_update(offset);
+
+			DeviceManager dm;
+			auto driver = new CMOSRTC();
+			driver->init(dm);
+
+			uint64_t start = sys.runtime();
+
+			RTCTimePoint tp;
+			driver->read_timepoint(tp);
+
+			uint64_t wait = sys.runtime() - start;
+			if (wait > worst_wait) {
+				worst_wait = wait;
+			}
+
+			bool before = same_time(tp, 2099, 12, 31, 23, 59, 59) && driver->century() == 20;
+			bool after = same_time(tp, 2100, 1, 1, 0, 0, 0) && driver->century() == 21;
+
+			CHECK(before || after);
+			CHECK(rtc.garbage_reads() == 0);
+
+			delete driver;
+		}
+	}
+
+	printf("  longest first read around an update: %lu us\n", worst_wait / 1000);
+	CHECK(worst_wait <= MC_UPDATE_NS + MC_UIP_LEAD_NS + 100000);
+}
+
+/**
+ * The cached time carries through the end of a leap-year February on its own, and picks up the new
+ * century when it is next refreshed from the RTC.
+ */
+static void test_rollover()
+{
+	MC146818 rtc;
+	rtc.set_time(2024, 2, 28, 23, 59, 58);
+
+	DeviceManager dm;
+	auto driver = new CMOSRTC();
+	driver->init(dm);
+
+	RTCTimePoint tp;
+	driver->read_timepoint(tp);
+	CHECK(same_time(tp, 2024, 2, 28, 23, 59, 58));
+
+	rtc.run_for(2 * MC_NS_PER_SEC);
+	driver->read_timepoint(tp);
+	CHECK(same_time(tp, 2024, 2, 29, 0, 0, 0));
+	CHECK(same_time(tp, rtc));
+
+	rtc.set_time(2099, 12, 31, 23, 59, 0);
+	rtc.run_for(RTC_RESYNC_INTERVAL);
+	driver->read_timepoint(tp);
+	CHECK(same_time(tp, 2100, 1, 1, 0, 0, 0));
+	CHECK(driver->century() == 21);
+
+	delete driver;
+}
+
+/**
+ * Without the century register, the century is reported as unknown rather than made up.
+ */
+static void test_no_century()
+{
+	MC146818 rtc;
+	rtc.set_century_register(false);
+	rtc.set_time(2024, 6, 1, 12, 0, 0);
+
+	DeviceManager dm;
+	auto driver = new CMOSRTC();
+	driver->init(dm);
+
+	RTCTimePoint tp;
+	driver->read_timepoint(tp);
+	CHECK(same_time(tp, 2024, 6, 1, 12, 0, 0));
+	CHECK(driver->century() == 0);
+
+	delete driver;
+}
+
+/**
+ * Polled reads only touch the RTC once every RTC_RESYNC_INTERVAL.  When the RTC turns out to be behind
+ * the kernel's clock, its time is still taken, but the time is held where it was until the RTC catches
+ * up, so it never goes backwards.
+ */
+static void test_polled_resync()
+{
+	MC146818 rtc;
+	rtc.set_time(2024, 6, 1, 12, 0, 0);
+
+	DeviceManager dm;
+	auto driver = new CMOSRTC();
+	driver->init(dm);
+
+	RTCTimePoint tp;
+	driver->read_timepoint(tp);
+	CHECK(time_page.tsc_frequency == 0);
+
+	// The time page is republished as soon as the TSC frequency is known.
+	rtc.run_for(MC_NS_PER_SEC);
+	driver->read_timepoint(tp);
+	CHECK(same_time(tp, rtc));
+	CHECK(time_page.tsc_frequency != 0);
+
+	uint64_t io = rtc.port_io_count();
+	for (int i = 0; i < 58; i++) {
+		rtc.run_for(MC_NS_PER_SEC);
+		driver->read_timepoint(tp);
+		CHECK(same_time(tp, rtc));
+	}
+	CHECK(rtc.port_io_count() == io);
+
+	// The RTC loses five seconds against the kernel's clock.
+	rtc.run_for(2 * MC_NS_PER_SEC);
+	rtc.set_time(2024, 6, 1, 12, 0, 56);
+
+	driver->read_timepoint(tp);
+	CHECK(rtc.port_io_count() > io);
+	CHECK(same_time(tp, 2024, 6, 1, 12, 1, 1));
+
+	// Processes reading the time page are held there too.
+	CHECK(time_page.floor_wall_seconds == time_page.base_wall_seconds + 5);
+
+	// The time stands still until the RTC catches up, and then follows it, without touching the RTC.
+	io = rtc.port_io_count();
+	for (int i = 0; i < 10; i++) {
+		rtc.run_for(MC_NS_PER_SEC);
+		driver->read_timepoint(tp);
+
+		if (i < 5) {
+			CHECK(same_time(tp, 2024, 6, 1, 12, 1, 1));
+		} else {
+			CHECK(same_time(tp, rtc));
+		}
+	}
+	CHECK(rtc.port_io_count() == io);
+
+	// The kernel's clock runs slow: the RTC's time is taken at the next resync.
+	rtc.set_time(2024, 6, 1, 12, 2, 30);
+	rtc.run_for(RTC_RESYNC_INTERVAL);
+	driver->read_timepoint(tp);
+	CHECK(same_time(tp, rtc));
+	CHECK(time_page.floor_wall_seconds == 0);
+
+	delete driver;
+}
+
+static unsigned int timer_fired;
+static uint64_t timer_fired_at;
+
+static void count_timer(CoarseTimer *timer, void *priv)
+{
+	timer_fired++;
+	timer_fired_at = sys.runtime();
+}
+
+/**
+ * With the interrupt, the time is first read straight after an update, after which the RTC stays
+ * quiet until the resync is due, apart from the alarm for any timer.
+ */
+static void test_interrupt_driven()
+{
+	MC146818 rtc;
+	rtc.set_time(2024, 6, 1, 23, 59, 50);
+	rtc.set_mode(false, true);
+	rtc.set_next_update(MC_NS_PER_SEC / 2);
+
+	IOAPIC ioapic;
+	rtc.attach(ioapic.request_physical_irq(RTC_IRQ));
+
+	DeviceManager dm;
+	dm.add_device(&ioapic);
+
+	auto driver = new CMOSRTC();
+	driver->init(dm);
+	CHECK(rtc.peek(0xB) & MC_B_UIE);
+
+	// The first update comes too soon to measure the TSC frequency, so the interrupt is left on for
+	// the second, which republishes the time page with the frequency.
+	rtc.run_for(MC_NS_PER_SEC);
+	CHECK(rtc.interrupts() == 1);
+	CHECK(rtc.peek(0xB) & MC_B_UIE);
+	CHECK(time_page.tsc_frequency == 0);
+
+	rtc.run_for(MC_NS_PER_SEC);
+	CHECK(rtc.interrupts() == 2);
+	CHECK(!(rtc.peek(0xB) & MC_B_UIE));
+	CHECK(time_page.tsc_frequency != 0);
+	CHECK(rtc.peek(0xB) & MC_B_AIE);
+
+	uint64_t io = rtc.port_io_count();
+	RTCTimePoint tp;
+	driver->read_timepoint(tp);
+	CHECK(same_time(tp, rtc));
+	CHECK(rtc.port_io_count() == io);
+
+	// A timer sets the alarm, in 12-hour mode and across midnight.
+	CoarseTimer timer(count_timer, nullptr);
+	uint64_t start = sys.runtime();
+
+	CHECK(driver->add_timer(timer, 15));
+	rtc.run_for(20 * MC_NS_PER_SEC);
+
+	CHECK(timer_fired == 1);
+	CHECK(timer_fired_at - start >= 14 * MC_NS_PER_SEC && timer_fired_at - start <= 17 * MC_NS_PER_SEC);
+	printf("  timer for 15s fired after %.3fs, %lu interrupts in 21s\n",
+		(timer_fired_at - start) / 1e9, rtc.interrupts());
+	CHECK(rtc.interrupts() <= 4);
+
+	// The resync turns the update-ended interrupt back on, once.
+	uint64_t interrupts = rtc.interrupts();
+	rtc.run_for(RTC_RESYNC_INTERVAL);
+	CHECK(rtc.interrupts() - interrupts <= 3);
+	CHECK(!(rtc.peek(0xB) & MC_B_UIE));
+
+	driver->read_timepoint(tp);
+	CHECK(same_time(tp, rtc));
+
+	// Reading the RTC from a thread, after the alarm has gone off but before its interrupt has been
+	// handled, does not swallow the alarm.
+	timer_fired = 0;
+	CHECK(driver->add_timer(timer, 2));
+	sys.advance(3 * MC_NS_PER_SEC);
+
+	driver->read_rtc(tp);
+	rtc.run_for(1000);
+	CHECK(timer_fired == 1);
+
+	delete driver;
+}
+
+/**
+ * Profiling samples are only written out by threads reading the time, never by the interrupt handler:
+ * as soon as a buffer fills, and every PROFILE_DUMP_INTERVAL otherwise.
+ */
+static void test_profile()
+{
+	MC146818 rtc;
+	rtc.set_time(2024, 6, 1, 12, 0, 0);
+
+	IOAPIC ioapic;
+	rtc.attach(ioapic.request_physical_irq(RTC_IRQ));
+
+	DeviceManager dm;
+	dm.add_device(&ioapic);
+
+	// Sample at 2Hz, so a buffer takes over two minutes to fill.
+	X86Context context = { 0x1234 };
+	Thread thread;
+	thread.context().native_context = &context;
+	sys.scheduler().set_current_entity(thread);
+	profile_rate = 15;
+
+	auto driver = new CMOSRTC();
+	driver->init(dm);
+	CHECK(rtc.peek(0xB) & MC_B_PIE);
+
+	syslog.set_quiet(true);
+
+	RTCTimePoint tp;
+	rtc.run_for(5 * MC_NS_PER_SEC);
+	driver->read_timepoint(tp);
+
+	// Nothing more is written out until PROFILE_DUMP_INTERVAL after that.
+	unsigned int messages = syslog.messages();
+	rtc.run_for(5 * MC_NS_PER_SEC);
+	driver->read_timepoint(tp);
+	CHECK(syslog.messages() == messages);
+
+	rtc.run_for(PROFILE_DUMP_INTERVAL - 5 * MC_NS_PER_SEC);
+	driver->read_timepoint(tp);
+	CHECK(syslog.messages() - messages == PROFILE_DUMP_INTERVAL / MC_NS_PER_SEC * 2);
+
+	// A full buffer is written out by the next read, with a count of what was dropped whilst waiting.
+	messages = syslog.messages();
+	rtc.run_for(200 * MC_NS_PER_SEC);
+	CHECK(syslog.messages() == messages);
+
+	driver->read_timepoint(tp);
+	CHECK(syslog.messages() - messages == PROFILE_BUFFER_SIZE + 1);
+
+	syslog.set_quiet(false);
+	profile_rate = 0;
+
+	delete driver;
+}
+
+/**
+ * The boot marker is logged by the first read of the time, and never again.
+ */
+static void test_boot_marker()
+{
+	MC146818 rtc;
+	rtc.set_time(2024, 6, 1, 12, 0, 0);
+
+	DeviceManager dm;
+	auto driver = new CMOSRTC();
+	driver->init(dm);
+
+	__cmdline_RTCBootMarker("1");
+
+	RTCTimePoint tp;
+	unsigned int messages = syslog.messages();
+	driver->read_timepoint(tp);
+	CHECK(syslog.messages() - messages == 1);
+
+	driver->read_timepoint(tp);
+	CHECK(syslog.messages() - messages == 1);
+
+	boot_marker = false;
+
+	delete driver;
+}
+
+int main()
+{
+	test_register_formats();
+	test_update_boundary();
+	test_rollover();
+	test_no_century();
+	test_polled_resync();
+	test_interrupt_driven();
+	test_profile();
+	test_boot_marker();
+
+	return TEST_RESULT();
+}
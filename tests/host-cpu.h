@@ -0,0 +1,13 @@
+/*
+ * Lets a test choose which CPU the kernel source believes it is running on.  Include this before the
+ * kernel source: the real cpu.h is then skipped, and current_cpu() returns test_cpu instead.
+ */
+#pragma once
+
+#define current_cpu hardware_current_cpu
+#include "../cpu.h"
+#undef current_cpu
+
+static unsigned int test_cpu;
+
+static inline unsigned int current_cpu() { return test_cpu; }
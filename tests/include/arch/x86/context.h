@@ -0,0 +1,11 @@
+/*
+ * Host stand-in for the saved x86 register state of a thread.
+ */
+#pragma once
+
+#include <stdint.h>
+
+struct X86Context
+{
+	uint64_t rip;
+};
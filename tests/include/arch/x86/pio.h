@@ -0,0 +1,27 @@
+/*
+ * Host stand-in for x86 port I/O, which forwards every access to whichever emulated device the test
+ * has installed.
+ */
+#pragma once
+
+#include <stdint.h>
+
+namespace infos {
+	namespace arch {
+		namespace x86 {
+			class PortIO
+			{
+			public:
+				virtual ~PortIO() { }
+
+				virtual uint8_t inb(uint16_t port) = 0;
+				virtual void outb(uint16_t port, uint8_t value) = 0;
+			};
+
+			inline PortIO *port_io;
+
+			static inline uint8_t __inb(uint16_t port) { return port_io->inb(port); }
+			static inline void __outb(uint16_t port, uint8_t value) { port_io->outb(port, value); }
+		}
+	}
+}
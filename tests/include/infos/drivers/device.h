@@ -0,0 +1,67 @@
+/*
+ * Host stand-in for InfOS devices, and the device manager that finds them.
+ */
+#pragma once
+
+namespace infos {
+	namespace drivers {
+		class DeviceClass
+		{
+		public:
+			DeviceClass() : _parent(nullptr), _name("device") { }
+			DeviceClass(const DeviceClass& parent, const char *name) : _parent(&parent), _name(name) { }
+
+		private:
+			const DeviceClass *_parent;
+			const char *_name;
+		};
+	}
+
+	namespace kernel {
+		class DeviceManager;
+	}
+
+	namespace drivers {
+		class Device
+		{
+		public:
+			virtual ~Device() { }
+
+			virtual const DeviceClass& device_class() const = 0;
+			virtual bool init(kernel::DeviceManager& dm) { return true; }
+		};
+	}
+
+	namespace kernel {
+		/**
+		 * Holds the devices a test has made available.
+		 */
+		class DeviceManager
+		{
+		public:
+			DeviceManager() : _nr_devices(0) { }
+
+			void add_device(drivers::Device *device) { _devices[_nr_devices++] = device; }
+
+			template<typename T>
+			bool try_get_device_by_class(const drivers::DeviceClass& device_class, T*& device)
+			{
+				for (unsigned int i = 0; i < _nr_devices; i++) {
+					if (&_devices[i]->device_class() == &device_class) {
+						device = (T *)_devices[i];
+						return true;
+					}
+				}
+
+				return false;
+			}
+
+		private:
+			drivers::Device *_devices[8];
+			unsigned int _nr_devices;
+		};
+	}
+}
+
+// Tests construct the device themselves.
+#define RegisterDevice(_class)
@@ -0,0 +1,26 @@
+/*
+ * Host stand-in for the InfOS I/O APIC, whose interrupt lines tests raise by hand.
+ */
+#pragma once
+
+#include <infos/drivers/device.h>
+#include <infos/kernel/irq.h>
+
+namespace infos {
+	namespace drivers {
+		namespace irq {
+			class IOAPIC : public Device
+			{
+			public:
+				static inline const DeviceClass IOAPICDeviceClass;
+
+				const DeviceClass& device_class() const override { return IOAPICDeviceClass; }
+
+				kernel::IRQ *request_physical_irq(unsigned int irq) { return irq < 24 ? &_irqs[irq] : nullptr; }
+
+			private:
+				kernel::IRQ _irqs[24];
+			};
+		}
+	}
+}
@@ -0,0 +1,25 @@
+/*
+ * Host stand-in for the InfOS RTC device interface.
+ */
+#pragma once
+
+#include <infos/drivers/device.h>
+
+namespace infos {
+	namespace drivers {
+		namespace timer {
+			struct RTCTimePoint
+			{
+				unsigned short seconds, minutes, hours, day_of_month, month, year;
+			};
+
+			class RTC : public Device
+			{
+			public:
+				static inline const DeviceClass RTCDeviceClass;
+
+				virtual void read_timepoint(RTCTimePoint& tp) = 0;
+			};
+		}
+	}
+}
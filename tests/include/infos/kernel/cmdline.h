@@ -0,0 +1,6 @@
+/*
+ * Host stand-in for InfOS command-line arguments.  Tests set the variables the handlers would set.
+ */
+#pragma once
+
+#define RegisterCmdLineArgument(_name, _key) static void __cmdline_##_name(const char *value)
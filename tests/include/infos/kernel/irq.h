@@ -0,0 +1,43 @@
+/*
+ * Host stand-in for an InfOS interrupt line, which tests raise by hand.
+ */
+#pragma once
+
+namespace infos {
+	namespace kernel {
+		class IRQ
+		{
+		public:
+			typedef void (*irq_handler_t)(const IRQ *irq, void *priv);
+
+			IRQ() : _handler(nullptr), _priv(nullptr), _enabled(false) { }
+
+			void attach(irq_handler_t handler, void *priv)
+			{
+				_handler = handler;
+				_priv = priv;
+			}
+
+			void enable() { _enabled = true; }
+
+			/**
+			 * Runs the attached handler, as the interrupt controller would.
+			 * @return Returns TRUE if the line is enabled and a handler ran.
+			 */
+			bool raise()
+			{
+				if (!_enabled || !_handler) {
+					return false;
+				}
+
+				_handler(this, _priv);
+				return true;
+			}
+
+		private:
+			irq_handler_t _handler;
+			void *_priv;
+			bool _enabled;
+		};
+	}
+}
@@ -0,0 +1,47 @@
+/*
+ * Host stand-in for the InfOS kernel object, whose clock is advanced by the test.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <infos/kernel/log.h>
+#include <infos/kernel/sched.h>
+#include <infos/mm/mm.h>
+
+namespace infos {
+	namespace kernel {
+		/**
+		 * The scheduler, as far as drivers see it: whatever the test says is running.
+		 */
+		class Scheduler
+		{
+		public:
+			Scheduler() : _current(nullptr) { }
+
+			SchedulingEntity& current_entity() { return *_current; }
+			void set_current_entity(SchedulingEntity& entity) { _current = &entity; }
+
+		private:
+			SchedulingEntity *_current;
+		};
+
+		class Kernel
+		{
+		public:
+			Kernel() : _runtime(0) { }
+
+			uint64_t runtime() const { return _runtime; }
+			void advance(uint64_t nanoseconds) { _runtime += nanoseconds; }
+
+			Scheduler& scheduler() { return _scheduler; }
+			infos::mm::MemoryManager& mm() { return _mm; }
+
+		private:
+			uint64_t _runtime;
+			Scheduler _scheduler;
+			infos::mm::MemoryManager _mm;
+		};
+
+		inline Kernel sys;
+	}
+}
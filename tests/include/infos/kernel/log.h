@@ -0,0 +1,57 @@
+/*
+ * Host stand-in for the InfOS kernel log, which prints to stdout, and counts what it is given so that
+ * tests can tell when something was logged.
+ */
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <assert.h>
+
+namespace infos {
+	namespace kernel {
+		namespace LogLevel {
+			enum LogLevel { DEBUG, INFO, IMPORTANT, WARNING, ERROR, FATAL };
+		}
+
+		class ComponentLog
+		{
+		public:
+			ComponentLog() : _messages(0), _quiet(false) { }
+
+			void message(LogLevel::LogLevel level, const char *message)
+			{
+				_messages++;
+				if (!_quiet) {
+					printf("%s\n", message);
+				}
+			}
+
+			void messagef(LogLevel::LogLevel level, const char *format, ...)
+			{
+				_messages++;
+				if (_quiet) {
+					return;
+				}
+
+				va_list args;
+				va_start(args, format);
+				vprintf(format, args);
+				va_end(args);
+				printf("\n");
+			}
+
+			// The number of messages logged so far.
+			unsigned int messages() const { return _messages; }
+
+			// Stops messages being printed, for tests that log a lot.  They are still counted.
+			void set_quiet(bool quiet) { _quiet = quiet; }
+
+		private:
+			unsigned int _messages;
+			bool _quiet;
+		};
+
+		inline ComponentLog syslog;
+	}
+}
@@ -0,0 +1,55 @@
+/*
+ * Host stand-in for the InfOS scheduler interface.
+ */
+#pragma once
+
+#include <stdint.h>
+
+namespace infos {
+	namespace kernel {
+		namespace SchedulingEntityState {
+			enum SchedulingEntityState {
+				STOPPED,
+				RUNNABLE,
+				RUNNING,
+				SLEEPING
+			};
+		}
+
+		/**
+		 * An entity whose CPU runtime and state are set by the test, rather than by running.
+		 */
+		class SchedulingEntity
+		{
+		public:
+			typedef uint64_t EntityRuntime;
+			typedef uint64_t EntityStartTime;
+
+			SchedulingEntity() : _runtime(0), _state(SchedulingEntityState::RUNNABLE) { }
+
+			EntityRuntime cpu_runtime() const { return _runtime; }
+			SchedulingEntityState::SchedulingEntityState state() const { return _state; }
+
+			void run_for(EntityRuntime runtime) { _runtime += runtime; }
+			void set_state(SchedulingEntityState::SchedulingEntityState state) { _state = state; }
+
+		private:
+			EntityRuntime _runtime;
+			SchedulingEntityState::SchedulingEntityState _state;
+		};
+
+		class SchedulingAlgorithm
+		{
+		public:
+			virtual ~SchedulingAlgorithm() { }
+
+			virtual const char *name() const = 0;
+			virtual void add_to_runqueue(SchedulingEntity& entity) = 0;
+			virtual void remove_from_runqueue(SchedulingEntity& entity) = 0;
+			virtual SchedulingEntity *pick_next_entity() = 0;
+		};
+	}
+}
+
+// Tests construct the algorithm themselves.
+#define RegisterScheduler(_class)
@@ -0,0 +1,26 @@
+/*
+ * Host stand-in for the InfOS thread interface.
+ */
+#pragma once
+
+#include <infos/kernel/sched.h>
+
+namespace infos {
+	namespace kernel {
+		struct ThreadContext
+		{
+			void *native_context;
+		};
+
+		class Thread : public SchedulingEntity
+		{
+		public:
+			Thread() : _context { nullptr } { }
+
+			ThreadContext& context() { return _context; }
+
+		private:
+			ThreadContext _context;
+		};
+	}
+}
@@ -0,0 +1,22 @@
+/*
+ * Host stand-in for the InfOS memory manager, which only holds the page allocator.
+ */
+#pragma once
+
+#include <infos/kernel/log.h>
+#include <infos/mm/page-allocator.h>
+
+namespace infos {
+	namespace mm {
+		class MemoryManager
+		{
+		public:
+			PageAllocator& pgalloc() { return _pgalloc; }
+
+		private:
+			PageAllocator _pgalloc;
+		};
+
+		inline infos::kernel::ComponentLog mm_log;
+	}
+}
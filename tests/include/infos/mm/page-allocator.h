@@ -0,0 +1,54 @@
+/*
+ * Host stand-in for the InfOS page allocator interface.  The test hands it an array of page descriptors,
+ * numbered from PFN 0, and the memory behind them.
+ */
+#pragma once
+
+#include <stdint.h>
+
+namespace infos {
+	namespace mm {
+		struct PageDescriptor
+		{
+			PageDescriptor *next_free;
+		};
+
+		class PageAllocatorAlgorithm
+		{
+		public:
+			virtual ~PageAllocatorAlgorithm() { }
+
+			virtual bool init(PageDescriptor *page_descriptors, uint64_t nr_page_descriptors) = 0;
+			virtual PageDescriptor *alloc_pages(int order) = 0;
+			virtual void free_pages(PageDescriptor *pgd, int order) = 0;
+			virtual const char *name() const = 0;
+			virtual void dump_state() const = 0;
+		};
+
+		class PageAllocator
+		{
+		public:
+			PageAllocator() : _page_descriptors(nullptr), _memory(nullptr) { }
+
+			/**
+			 * Sets the page descriptors, and the memory they describe, 4KB per page.
+			 */
+			void set_memory(PageDescriptor *page_descriptors, void *memory)
+			{
+				_page_descriptors = page_descriptors;
+				_memory = (uint8_t *)memory;
+			}
+
+			uint64_t pgd_to_pfn(const PageDescriptor *pgd) const { return pgd - _page_descriptors; }
+			PageDescriptor *pfn_to_pgd(uint64_t pfn) const { return _page_descriptors + pfn; }
+			void *pgd_to_vpa(const PageDescriptor *pgd) const { return _memory + (pgd_to_pfn(pgd) << 12); }
+
+		private:
+			PageDescriptor *_page_descriptors;
+			uint8_t *_memory;
+		};
+	}
+}
+
+// Tests create the allocators they need themselves.
+#define RegisterPageAllocator(_class)
@@ -0,0 +1,126 @@
+/*
+ * Host stand-in for the InfOS linked list.
+ */
+#pragma once
+
+#include <stddef.h>
+
+namespace infos {
+	namespace util {
+		template<typename T>
+		class List
+		{
+			struct Node
+			{
+				T value;
+				Node *next;
+			};
+
+		public:
+			class Iterator
+			{
+			public:
+				Iterator(Node *node) : _node(node) { }
+
+				T& operator*() const { return _node->value; }
+				Iterator& operator++() { _node = _node->next; return *this; }
+				bool operator!=(const Iterator& other) const { return _node != other._node; }
+
+			private:
+				Node *_node;
+			};
+
+			List() : _head(nullptr), _tail(nullptr), _count(0) { }
+			~List() { clear(); }
+
+			void append(T value)
+			{
+				auto node = new Node { value, nullptr };
+
+				if (_tail) {
+					_tail->next = node;
+				} else {
+					_head = node;
+				}
+
+				_tail = node;
+				_count++;
+			}
+
+			void enqueue(T value) { append(value); }
+
+			void push(T value)
+			{
+				_head = new Node { value, _head };
+				if (!_tail) {
+					_tail = _head;
+				}
+
+				_count++;
+			}
+
+			T pop()
+			{
+				auto node = _head;
+				T value = node->value;
+
+				_head = node->next;
+				if (!_head) {
+					_tail = nullptr;
+				}
+
+				_count--;
+				delete node;
+
+				return value;
+			}
+
+			T dequeue() { return pop(); }
+
+			void remove(T value)
+			{
+				Node *prev = nullptr;
+
+				for (auto node = _head; node; prev = node, node = node->next) {
+					if (node->value != value) {
+						continue;
+					}
+
+					if (prev) {
+						prev->next = node->next;
+					} else {
+						_head = node->next;
+					}
+
+					if (_tail == node) {
+						_tail = prev;
+					}
+
+					_count--;
+					delete node;
+					return;
+				}
+			}
+
+			void clear()
+			{
+				while (_head) {
+					pop();
+				}
+			}
+
+			T first() const { return _head->value; }
+			T last() const { return _tail->value; }
+			size_t count() const { return _count; }
+			bool empty() const { return _count == 0; }
+
+			Iterator begin() const { return Iterator(_head); }
+			Iterator end() const { return Iterator(nullptr); }
+
+		private:
+			Node *_head;
+			Node *_tail;
+			size_t _count;
+		};
+	}
+}
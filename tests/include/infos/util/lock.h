@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for the InfOS locks.  Tests are single-threaded, so nothing needs disabling.
+ */
+#pragma once
+
+namespace infos {
+	namespace util {
+		class UniqueIRQLock
+		{
+		public:
+			UniqueIRQLock() { }
+			~UniqueIRQLock() { }
+		};
+	}
+}
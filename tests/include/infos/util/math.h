@@ -0,0 +1,6 @@
+/*
+ * Host stand-in for the InfOS maths utilities.
+ */
+#pragma once
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
@@ -0,0 +1,6 @@
+/*
+ * Host stand-in for the InfOS string formatting functions.
+ */
+#pragma once
+
+#include <stdio.h>
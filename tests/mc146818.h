@@ -0,0 +1,410 @@
+/*
+ * Host-side emulation of the MC146818 real-time clock, as found (give or take the century register)
+ * in every PC.  It sits behind the stand-in __inb/__outb, and keeps time against the stand-in kernel
+ * clock, which every port access moves on by the cost of an ISA bus cycle.
+ */
+#pragma once
+
+#include <string.h>
+#include <arch/x86/pio.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/irq.h>
+
+#define MC_NS_PER_SEC		1000000000ULL
+
+// How long before an update the update-in-progress bit is raised, and how long the update itself
+// takes, with the usual 32.768kHz time base.  The time registers are undefined during the update.
+#define MC_UIP_LEAD_NS		244000ULL
+#define MC_UPDATE_NS		1984000ULL
+
+// How long one port access takes, by default.
+#define MC_IO_COST_NS		1000ULL
+
+// Status register A: update in progress.
+#define MC_A_UIP		0x80
+
+// Status register B: halt updates, interrupt enables, binary mode and 24-hour mode.
+#define MC_B_SET		0x80
+#define MC_B_PIE		0x40
+#define MC_B_AIE		0x20
+#define MC_B_UIE		0x10
+#define MC_B_BINARY		0x04
+#define MC_B_24HOUR		0x02
+
+// Status register C: interrupt request, and the periodic, alarm and update-ended flags.
+#define MC_C_IRQF		0x80
+#define MC_C_PF			0x40
+#define MC_C_AF			0x20
+#define MC_C_UF			0x10
+
+#define MC_CENTURY		0x32
+
+/**
+ * The emulated RTC.  Only one may exist at a time, as it installs itself as the target of all port I/O.
+ * The periodic interrupt only runs whilst it is enabled, at the rate selected in status register A.
+ */
+class MC146818 : public infos::arch::x86::PortIO
+{
+public:
+	MC146818() : _address(0), _irq(nullptr), _io_cost(MC_IO_COST_NS), _port_io(0), _interrupts(0),
+		_garbage_reads(0), _has_century(true)
+	{
+		memset(_ram, 0, sizeof(_ram));
+		_ram[0xA] = 0x26;
+		_ram[0xB] = MC_B_24HOUR;
+
+		set_time(2000, 1, 1, 0, 0, 0);
+		set_next_update(MC_NS_PER_SEC);
+		_next_periodic = 0;
+
+		infos::arch::x86::port_io = this;
+	}
+
+	~MC146818()
+	{
+		infos::arch::x86::port_io = nullptr;
+	}
+
+	/**
+	 * Sets the date & time held by the RTC.
+	 */
+	void set_time(unsigned int year, unsigned int month, unsigned int day, unsigned int hours,
+			unsigned int minutes, unsigned int seconds)
+	{
+		_century = year / 100;
+		_year = year % 100;
+		_month = month;
+		_day = day;
+		_hours = hours;
+		_minutes = minutes;
+		_seconds = seconds;
+	}
+
+	/**
+	 * Sets the data mode and hour mode, as the firmware would before handing over.
+	 */
+	void set_mode(bool binary, bool twelve_hour)
+	{
+		_ram[0xB] &= ~(MC_B_BINARY | MC_B_24HOUR);
+		_ram[0xB] |= (binary ? MC_B_BINARY : 0) | (twelve_hour ? 0 : MC_B_24HOUR);
+	}
+
+	/**
+	 * Sets whether the century register is implemented.  If not, it reads as zero.
+	 */
+	void set_century_register(bool present) { _has_century = present; }
+
+	/**
+	 * Sets how long from now the next update finishes, and so when the time next changes.
+	 */
+	void set_next_update(uint64_t ns) { _next_update = infos::kernel::sys.runtime() + ns; }
+
+	/**
+	 * Sets how long each port access takes.
+	 */
+	void set_io_cost(uint64_t ns) { _io_cost = ns; }
+
+	/**
+	 * Routes the RTC's interrupt through the given line.
+	 */
+	void attach(infos::kernel::IRQ *irq) { _irq = irq; }
+
+	/**
+	 * Lets time pass, raising the interrupt whenever the RTC asks for it.
+	 */
+	void run_for(uint64_t ns)
+	{
+		uint64_t end = infos::kernel::sys.runtime() + ns;
+
+		for (;;) {
+			sync();
+			deliver();
+
+			uint64_t now = infos::kernel::sys.runtime();
+			if (now >= end) {
+				break;
+			}
+
+			uint64_t next = _next_update < end ? _next_update : end;
+			if ((_ram[0xB] & MC_B_PIE) && periodic_ns() && _next_periodic < next) {
+				next = _next_periodic;
+			}
+
+			infos::kernel::sys.advance(next - now);
+		}
+	}
+
+	uint8_t inb(uint16_t port) override
+	{
+		access();
+
+		if (port != 0x71) {
+			return 0xFF;
+		}
+
+		switch (_address) {
+		case 0x00: case 0x02: case 0x04: case 0x06: case 0x07: case 0x08: case 0x09: case MC_CENTURY:
+			// Mid-update, the time registers are being carried, and hold nothing useful.
+			if (in_update()) {
+				_garbage_reads++;
+				return 0xFF;
+			}
+
+			return read_time(_address);
+
+		case 0xA:
+			return (_ram[0xA] & ~MC_A_UIP) | (in_uip() ? MC_A_UIP : 0);
+
+		case 0xC: {
+			uint8_t flags = _ram[0xC];
+			_ram[0xC] = 0;
+			return flags;
+		}
+
+		case 0xD:
+			// Valid RAM and time.
+			return 0x80;
+
+		default:
+			return _ram[_address];
+		}
+	}
+
+	void outb(uint16_t port, uint8_t value) override
+	{
+		access();
+
+		if (port == 0x70) {
+			// The top bit masks NMIs, and is not part of the address.
+			_address = value & 0x7F;
+			return;
+		}
+
+		switch (_address) {
+		case 0x00: _seconds = decode(value); break;
+		case 0x02: _minutes = decode(value); break;
+		case 0x04: _hours = decode_hours(value); break;
+		case 0x07: _day = decode(value); break;
+		case 0x08: _month = decode(value); break;
+		case 0x09: _year = decode(value); break;
+		case MC_CENTURY: _century = decode(value); break;
+
+		case 0xA:
+			_ram[0xA] = value & ~MC_A_UIP;
+			break;
+
+		case 0xC: case 0xD:
+			// Read-only.
+			break;
+
+		default:
+			_ram[_address] = value;
+			break;
+		}
+	}
+
+	// The number of port accesses so far.
+	uint64_t port_io_count() const { return _port_io; }
+
+	// The number of interrupts raised so far.
+	uint64_t interrupts() const { return _interrupts; }
+
+	// The number of time registers read whilst they were undefined.
+	uint64_t garbage_reads() const { return _garbage_reads; }
+
+	// A register, as last written, without any side effects.
+	uint8_t peek(unsigned int reg) const { return _ram[reg]; }
+
+	unsigned int century() const { return _century; }
+	unsigned int year() const { return _year; }
+	unsigned int month() const { return _month; }
+	unsigned int day() const { return _day; }
+	unsigned int hours() const { return _hours; }
+	unsigned int minutes() const { return _minutes; }
+	unsigned int seconds() const { return _seconds; }
+
+private:
+	uint8_t _ram[128];
+	uint8_t _address;
+
+	// The date & time, in binary and 24-hour format whatever the mode.
+	unsigned int _century, _year, _month, _day, _hours, _minutes, _seconds;
+
+	// The kernel runtime at which the next update finishes, and at which the periodic interrupt is
+	// next due.
+	uint64_t _next_update;
+	uint64_t _next_periodic;
+
+	infos::kernel::IRQ *_irq;
+	uint64_t _io_cost;
+	uint64_t _port_io;
+	uint64_t _interrupts;
+	uint64_t _garbage_reads;
+	bool _has_century;
+
+	void access()
+	{
+		_port_io++;
+		infos::kernel::sys.advance(_io_cost);
+		sync();
+	}
+
+	// Both of these rely on sync() having been called, so that the next update is still to come.
+	bool in_uip() const
+	{
+		return _next_update - infos::kernel::sys.runtime() <= MC_UPDATE_NS + MC_UIP_LEAD_NS;
+	}
+
+	bool in_update() const
+	{
+		return _next_update - infos::kernel::sys.runtime() <= MC_UPDATE_NS;
+	}
+
+	/**
+	 * Carries out every update that has finished by now.
+	 */
+	void sync()
+	{
+		while (infos::kernel::sys.runtime() >= _next_update) {
+			if (!(_ram[0xB] & MC_B_SET)) {
+				tick();
+
+				_ram[0xC] |= MC_C_UF;
+				if (alarm_matches()) {
+					_ram[0xC] |= MC_C_AF;
+				}
+			}
+
+			_next_update += MC_NS_PER_SEC;
+		}
+
+		// The periodic interrupt counts from when it is enabled.
+		uint64_t period = periodic_ns();
+		if (!(_ram[0xB] & MC_B_PIE) || !period) {
+			_next_periodic = infos::kernel::sys.runtime() + period;
+		} else {
+			while (infos::kernel::sys.runtime() >= _next_periodic) {
+				_ram[0xC] |= MC_C_PF;
+				_next_periodic += period;
+			}
+		}
+
+		if (_ram[0xC] & _ram[0xB] & (MC_C_PF | MC_C_AF | MC_C_UF)) {
+			_ram[0xC] |= MC_C_IRQF;
+		}
+	}
+
+	/**
+	 * Raises the interrupt, if one is being asked for.
+	 */
+	void deliver()
+	{
+		if (_irq && (_ram[0xC] & MC_C_IRQF)) {
+			_interrupts++;
+			_irq->raise();
+		}
+	}
+
+	/**
+	 * Returns the period of the periodic interrupt, or zero if it is turned off.  Rates 1 and 2 are
+	 * not supported with the usual time base.
+	 */
+	uint64_t periodic_ns() const
+	{
+		unsigned int rate = _ram[0xA] & 0x0F;
+		return rate >= 3 ? MC_NS_PER_SEC / (32768 >> (rate - 1)) : 0;
+	}
+
+	static bool is_leap_year(unsigned int year)
+	{
+		return ((year % 4) == 0 && (year % 100) != 0) || (year % 400) == 0;
+	}
+
+	void tick()
+	{
+		static const unsigned int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+		if (++_seconds < 60) return;
+		_seconds = 0;
+		if (++_minutes < 60) return;
+		_minutes = 0;
+		if (++_hours < 24) return;
+		_hours = 0;
+
+		unsigned int month_days = days[_month - 1];
+		if (_month == 2 && is_leap_year(_century * 100 + _year)) {
+			month_days = 29;
+		}
+
+		if (++_day <= month_days) return;
+		_day = 1;
+		if (++_month <= 12) return;
+		_month = 1;
+		if (++_year < 100) return;
+		_year = 0;
+		_century++;
+	}
+
+	bool binary() const { return _ram[0xB] & MC_B_BINARY; }
+	bool twelve_hour() const { return !(_ram[0xB] & MC_B_24HOUR); }
+
+	uint8_t encode(unsigned int value) const
+	{
+		return binary() ? value : (((value / 10) << 4) | (value % 10));
+	}
+
+	unsigned int decode(uint8_t value) const
+	{
+		return binary() ? value : (((value >> 4) * 10) + (value & 0xF));
+	}
+
+	uint8_t encode_hours(unsigned int hours) const
+	{
+		if (!twelve_hour()) {
+			return encode(hours);
+		}
+
+		return encode(hours % 12 ? hours % 12 : 12) | (hours >= 12 ? 0x80 : 0);
+	}
+
+	unsigned int decode_hours(uint8_t value) const
+	{
+		if (!twelve_hour()) {
+			return decode(value);
+		}
+
+		return (decode(value & 0x7F) % 12) + ((value & 0x80) ? 12 : 0);
+	}
+
+	uint8_t read_time(unsigned int reg) const
+	{
+		switch (reg) {
+		case 0x00: return encode(_seconds);
+		case 0x02: return encode(_minutes);
+		case 0x04: return encode_hours(_hours);
+		case 0x06: return encode(1);
+		case 0x07: return encode(_day);
+		case 0x08: return encode(_month);
+		case 0x09: return encode(_year);
+		default: return _has_century ? encode(_century) : 0;
+		}
+	}
+
+	/**
+	 * Checks the alarm registers against the time.  An alarm register with its top two bits set
+	 * matches anything.
+	 */
+	bool alarm_matches() const
+	{
+		static const unsigned int regs[] = { 0x00, 0x02, 0x04 };
+
+		for (unsigned int i = 0; i < 3; i++) {
+			uint8_t alarm = _ram[regs[i] + 1];
+			if ((alarm & 0xC0) != 0xC0 && alarm != read_time(regs[i])) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
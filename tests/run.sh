@@ -0,0 +1,37 @@
+#!/bin/sh
+
+# Builds and runs the host-side tests.  Each test includes the kernel source it tests directly, and
+# builds against the stand-in kernel headers in tests/include.
+#
+# Usage: tests/run.sh [test-name...]
+
+TESTS_DIRECTORY=`dirname $0`
+OUTPUT=${OUTPUT:-/tmp/infos-tests}
+CXX=${CXX:-g++}
+
+mkdir -p $OUTPUT || exit 1
+
+if [ $# -eq 0 ]
+  then
+    set -- `cd $TESTS_DIRECTORY && ls *.cpp | sed 's/\.cpp$//'`
+fi
+
+FAILED=0
+for TEST in "$@"; do
+  if ! $CXX -std=c++17 -O2 -Wall -Wno-unused-function -I$TESTS_DIRECTORY/include -o $OUTPUT/$TEST $TESTS_DIRECTORY/$TEST.cpp
+    then
+      echo "  ERROR: $TEST DID NOT BUILD"
+      FAILED=$((FAILED + 1))
+      continue
+  fi
+
+  if $OUTPUT/$TEST
+    then
+      echo "PASS: $TEST"
+    else
+      echo "FAIL: $TEST"
+      FAILED=$((FAILED + 1))
+  fi
+done
+
+[ $FAILED -eq 0 ]
@@ -0,0 +1,110 @@
+/*
+ * Checks that the group scheduler shares the CPU between groups by weight, however many entities each
+ * group holds.
+ */
+#include "test.h"
+#include "../sched-group.cpp"
+#include "../irq-trace.cpp"
+
+// The number of entities in the crowded group.
+#define CROWD			200
+
+// The number of scheduling events each check runs for.
+#define PICKS			120000
+
+/**
+ * Runs the scheduler for a number of picks, and returns the fraction of picks that went to entities in
+ * [first, first + count).
+ */
+static double share(GroupRoundRobinScheduler& scheduler, SchedulingEntity *first, int count, int picks)
+{
+	int hits = 0;
+
+	for (int i = 0; i < picks; i++) {
+		auto entity = scheduler.pick_next_entity();
+		if (entity >= first && entity < first + count) {
+			hits++;
+		}
+	}
+
+	return hits / (double)picks;
+}
+
+/**
+ * A group of 200 entities gets only its weight's share against a group of one, and each entity within
+ * it gets an equal part of that share.
+ */
+static void test_crowded_group()
+{
+	GroupRoundRobinScheduler scheduler;
+	SchedulingEntity crowd[CROWD], alone;
+
+	scheduler.add_to_runqueue(alone);
+
+	auto crowded = sched_create_group("crowded", 1, nullptr);
+	auto single = sched_create_group("single", 2, nullptr);
+	CHECK(crowded && single);
+
+	CHECK(sched_set_group(alone, single));
+	for (auto& entity : crowd) {
+		CHECK(sched_set_group(entity, crowded));
+		scheduler.add_to_runqueue(entity);
+	}
+
+	double crowd_share = share(scheduler, crowd, CROWD, PICKS);
+	printf("  %d entities at weight 1 against 1 at weight 2: %.3f of the CPU\n", CROWD, crowd_share);
+	CHECK(crowd_share > 0.33 && crowd_share < 0.34);
+
+	// Each member of the crowd gets 1/200th of the crowd's share.
+	int counts[CROWD] = { 0 };
+	for (int i = 0; i < PICKS; i++) {
+		auto entity = scheduler.pick_next_entity();
+		if (entity != &alone) {
+			counts[entity - crowd]++;
+		}
+	}
+
+	for (int count : counts) {
+		CHECK(count == PICKS / 3 / CROWD);
+	}
+
+	// Reweighting applies straight away.
+	CHECK(sched_set_group_weight(crowded, 2));
+	crowd_share = share(scheduler, crowd, CROWD, PICKS);
+	CHECK(crowd_share > 0.49 && crowd_share < 0.51);
+}
+
+/**
+ * Nested groups split their parent's share, and an empty group takes nothing.
+ */
+static void test_nesting()
+{
+	GroupRoundRobinScheduler scheduler;
+	SchedulingEntity outer, inner[2];
+
+	scheduler.add_to_runqueue(outer);
+
+	auto parent = scheduler.create_group("parent", 1);
+	auto child = scheduler.create_group("child", 1, parent);
+	auto empty = scheduler.create_group("empty", 5);
+	CHECK(parent && child && empty);
+
+	for (auto& entity : inner) {
+		CHECK(scheduler.set_group(entity, child));
+		scheduler.add_to_runqueue(entity);
+	}
+
+	// The root splits between the outer entity and the parent group; the child has all of the parent's.
+	CHECK(share(scheduler, inner, 2, PICKS) == 0.5);
+
+	CHECK(!scheduler.set_group_weight(scheduler.root_group(), 2));
+	CHECK(!scheduler.create_group("bad", 0));
+}
+
+int main()
+{
+	test_crowded_group();
+	test_nesting();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,113 @@
+/*
+ * Measures synchronous IPC round trips under the round-robin scheduler: a client wakes a server and
+ * blocks for the reply, on one CPU shared with CPU-bound entities, with and without yield_to().
+ * Times are simulated, with a scheduling event at every tick and whenever an entity blocks.
+ */
+#include <time.h>
+
+#include "test.h"
+#include "host-cpu.h"
+#include "../sched-rr.cpp"
+#include "../irq-trace.cpp"
+
+// The scheduling tick, and the CPU time the client and the server each spend on one message.
+#define TICK			1000000
+#define WORK			10000
+
+// The number of round trips measured, and the number of CPU-bound entities competing with them.
+#define ROUND_TRIPS		2000
+#define HOGS			4
+
+static uint64_t host_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Runs scheduling events, with each CPU-bound entity picked running until the next tick, until the
+ * given entity is picked.
+ */
+static void run_until(RoundRobinScheduler& scheduler, SchedulingEntity *entity)
+{
+	SchedulingEntity *picked;
+
+	while ((picked = scheduler.pick_next_entity()) != entity) {
+		picked->run_for(TICK);
+		sys.advance(TICK);
+	}
+}
+
+/**
+ * The picked entity does its part of the exchange, wakes its peer (handing over its timeslice, if asked
+ * to), and blocks.
+ */
+static void send(RoundRobinScheduler& scheduler, SchedulingEntity& from, SchedulingEntity& to, bool yield)
+{
+	from.run_for(WORK);
+	sys.advance(WORK);
+
+	scheduler.add_to_runqueue(to);
+	if (yield) {
+		sched_yield_to(to);
+	}
+
+	from.set_state(SchedulingEntityState::SLEEPING);
+	scheduler.remove_from_runqueue(from);
+	from.set_state(SchedulingEntityState::RUNNABLE);
+
+	run_until(scheduler, &to);
+}
+
+/**
+ * Runs the round trips, and returns the mean round trip time in nanoseconds.
+ */
+static uint64_t ping_pong(bool yield)
+{
+	RoundRobinScheduler scheduler;
+	SchedulingEntity client, server, hogs[HOGS];
+
+	for (auto& hog : hogs) {
+		scheduler.add_to_runqueue(hog);
+	}
+
+	scheduler.add_to_runqueue(client);
+	run_until(scheduler, &client);
+
+	uint64_t total = 0, worst = 0, host_start = host_ns();
+
+	for (int i = 0; i < ROUND_TRIPS; i++) {
+		uint64_t start = sys.runtime();
+
+		send(scheduler, client, server, yield);
+		send(scheduler, server, client, yield);
+
+		uint64_t time = sys.runtime() - start;
+		total += time;
+		if (time > worst) {
+			worst = time;
+		}
+	}
+
+	uint64_t host_time = host_ns() - host_start;
+
+	printf("  %-16s mean %8lu ns, worst %8lu ns, %4lu directed yields, %.0f ns of host time per round trip\n",
+		yield ? "with yield_to" : "without yield_to", total / ROUND_TRIPS, worst, scheduler.directed_yields(),
+		host_time / (double)ROUND_TRIPS);
+
+	return total / ROUND_TRIPS;
+}
+
+int main()
+{
+	uint64_t without = ping_pong(false);
+	uint64_t with = ping_pong(true);
+
+	// Handing over the timeslice means neither side waits for the CPU-bound entities, until the
+	// timeslice being passed back and forth runs out.
+	CHECK(with < without / 10);
+
+	return TEST_RESULT();
+}
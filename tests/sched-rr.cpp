@@ -0,0 +1,292 @@
+/*
+ * Checks the round-robin scheduler and the deadline class above it.
+ */
+#include "test.h"
+#include "host-cpu.h"
+#include "../sched-rr.cpp"
+#include "../irq-trace.cpp"
+
+// The length of each simulated scheduling tick.
+#define TICK			100000
+
+// Deadline parameters that reserve half of the CPU.
+#define HALF_RUNTIME		5000000
+#define HALF_PERIOD		10000000
+
+/**
+ * Runs whatever the scheduler picks on the current CPU for one tick, and returns it.
+ */
+static SchedulingEntity *tick(RoundRobinScheduler& scheduler)
+{
+	auto entity = scheduler.pick_next_entity();
+	if (entity) {
+		entity->run_for(TICK);
+	}
+
+	sys.advance(TICK);
+	return entity;
+}
+
+/**
+ * An entity that exits takes its deadline reservation with it, but one that goes to sleep keeps it.
+ */
+static void test_exit()
+{
+	RoundRobinScheduler scheduler;
+	SchedulingEntity sleeper, exiting, other;
+
+	CHECK(scheduler.set_deadline(sleeper, HALF_RUNTIME, HALF_PERIOD, HALF_PERIOD));
+	scheduler.add_to_runqueue(sleeper);
+	tick(scheduler);
+
+	sleeper.set_state(SchedulingEntityState::SLEEPING);
+	scheduler.remove_from_runqueue(sleeper);
+	CHECK(!scheduler.set_deadline(other, HALF_RUNTIME, HALF_PERIOD, HALF_PERIOD));
+
+	scheduler.clear_deadline(sleeper);
+	CHECK(scheduler.set_deadline(exiting, HALF_RUNTIME, HALF_PERIOD, HALF_PERIOD));
+	scheduler.add_to_runqueue(exiting);
+	tick(scheduler);
+
+	exiting.set_state(SchedulingEntityState::STOPPED);
+	scheduler.remove_from_runqueue(exiting);
+	CHECK(scheduler.set_deadline(other, HALF_RUNTIME, HALF_PERIOD, HALF_PERIOD));
+	CHECK(scheduler.pick_next_entity() == nullptr);
+}
+
+/**
+ * A periodic entity that blocks with budget left, and wakes just after its period has ended, has not
+ * missed a deadline.
+ */
+static void test_no_false_misses()
+{
+	RoundRobinScheduler scheduler;
+	SchedulingEntity periodic, hog;
+
+	CHECK(scheduler.set_deadline(periodic, 2000000, 10000000, 10000000));
+	scheduler.add_to_runqueue(hog);
+	scheduler.add_to_runqueue(periodic);
+
+	for (int period = 0; period < 100; period++) {
+		uint64_t woken = sys.runtime();
+
+		// Do half of the work reserved for each period, then block.
+		uint64_t used = periodic.cpu_runtime();
+		while (periodic.cpu_runtime() - used < 1000000) {
+			tick(scheduler);
+		}
+
+		periodic.set_state(SchedulingEntityState::SLEEPING);
+		scheduler.remove_from_runqueue(periodic);
+
+		while (sys.runtime() < woken + 10050000) {
+			CHECK(tick(scheduler) == &hog);
+		}
+
+		periodic.set_state(SchedulingEntityState::RUNNABLE);
+		scheduler.add_to_runqueue(periodic);
+	}
+
+	CHECK(scheduler.deadline_misses() == 0);
+}
+
+/**
+ * A deadline that really is missed is still counted: two entities with the same period and nearly the
+ * same deadline cannot both finish in time.
+ */
+static void test_real_miss()
+{
+	RoundRobinScheduler scheduler;
+	SchedulingEntity first, second;
+
+	CHECK(scheduler.set_deadline(first, 4000000, 4000000, 100000000));
+	CHECK(scheduler.set_deadline(second, 4000000, 5000000, 100000000));
+	scheduler.add_to_runqueue(first);
+	scheduler.add_to_runqueue(second);
+
+	for (int i = 0; i < 100; i++) {
+		tick(scheduler);
+	}
+
+	CHECK(scheduler.deadline_misses(first) == 0);
+	CHECK(scheduler.deadline_misses(second) == 1);
+}
+
+/**
+ * The controls reach the scheduler the kernel is adding entities to, and nothing before then.
+ */
+static void test_controls()
+{
+	RoundRobinScheduler::active = nullptr;
+
+	RoundRobinScheduler scheduler;
+	SchedulingEntity entity;
+	SchedulingEntity::EntityRuntime until;
+
+	CHECK(!sched_set_deadline(entity, HALF_RUNTIME, HALF_PERIOD, HALF_PERIOD));
+	CHECK(!sched_next_preemption(until));
+
+	scheduler.add_to_runqueue(entity);
+	CHECK(sched_set_deadline(entity, HALF_RUNTIME, HALF_PERIOD, HALF_PERIOD));
+	CHECK(sched_next_preemption(until) && until == HALF_RUNTIME);
+	CHECK(sched_clear_deadline(entity));
+	CHECK(sched_next_preemption(until) && until == NO_PREEMPTION);
+}
+
+/**
+ * Runnable entities on one CPU take turns, rather than the entity that has just run being picked again
+ * because it is cache-hot.
+ */
+static void test_rotation()
+{
+	RoundRobinScheduler scheduler;
+	SchedulingEntity entities[3];
+
+	for (auto& entity : entities) {
+		scheduler.add_to_runqueue(entity);
+	}
+
+	for (int i = 0; i < 3000; i++) {
+		tick(scheduler);
+	}
+
+	// Each has had a third of 300ms, give or take a timeslice.
+	for (auto& entity : entities) {
+		CHECK(entity.cpu_runtime() >= 98000000 && entity.cpu_runtime() <= 102000000);
+	}
+}
+
+/**
+ * A placement (and any migration) is counted once per wakeup, however many times the entity is picked
+ * while it stays runnable, and an entity that wakes up still cache-hot goes back to the CPU it last ran on.
+ */
+static void test_placements()
+{
+	RoundRobinScheduler scheduler;
+	SchedulingEntity woken, first, second;
+
+	// Runs alone on CPU 1, for many ticks, then sleeps.
+	test_cpu = 1;
+	scheduler.add_to_runqueue(woken);
+	for (int i = 0; i < 10; i++) {
+		CHECK(tick(scheduler) == &woken);
+	}
+
+	CHECK(scheduler.placements() == 1);
+	woken.set_state(SchedulingEntityState::SLEEPING);
+	scheduler.remove_from_runqueue(woken);
+
+	// Meanwhile, other entities start running on CPU 0.
+	test_cpu = 0;
+	scheduler.add_to_runqueue(first);
+	scheduler.add_to_runqueue(second);
+	CHECK(tick(scheduler) == &first);
+
+	// On waking, it runs on CPU 1 ahead of the entity at the front of the runqueue.
+	woken.set_state(SchedulingEntityState::RUNNABLE);
+	scheduler.add_to_runqueue(woken);
+
+	test_cpu = 1;
+	CHECK(tick(scheduler) == &woken);
+	CHECK(scheduler.placements() == 3);
+	CHECK(scheduler.migrations() == 0);
+
+	// Once it has gone cold, it wakes up wherever there is a CPU to run it.
+	woken.set_state(SchedulingEntityState::SLEEPING);
+	scheduler.remove_from_runqueue(woken);
+
+	test_cpu = 0;
+	for (int i = 0; i < 100; i++) {
+		tick(scheduler);
+	}
+
+	woken.set_state(SchedulingEntityState::RUNNABLE);
+	scheduler.add_to_runqueue(woken);
+
+	SchedulingEntity *picked;
+	while ((picked = tick(scheduler)) != &woken) {
+		CHECK(picked == &first || picked == &second);
+	}
+
+	CHECK(scheduler.migrations() == 1);
+	printf("  %lu placements, %lu migrations\n", scheduler.placements(), scheduler.migrations());
+}
+
+/**
+ * A sleeping deadline entity whose period has ended does not keep the tick running for a lone entity,
+ * and a runnable one is waited for until its next period, not its last.
+ */
+static void test_next_preemption()
+{
+	RoundRobinScheduler scheduler;
+	SchedulingEntity sleeper, lone;
+	SchedulingEntity::EntityRuntime until;
+
+	scheduler.add_to_runqueue(lone);
+	scheduler.add_to_runqueue(sleeper);
+	CHECK(scheduler.set_deadline(sleeper, 1000000, HALF_PERIOD, HALF_PERIOD));
+	tick(scheduler);
+
+	sleeper.set_state(SchedulingEntityState::SLEEPING);
+	scheduler.remove_from_runqueue(sleeper);
+
+	for (int i = 0; i < 200; i++) {
+		CHECK(tick(scheduler) == &lone);
+	}
+
+	CHECK(scheduler.next_preemption() == NO_PREEMPTION);
+
+	// Once awake, and out of budget, the entity takes over again when its next period starts.
+	sleeper.set_state(SchedulingEntityState::RUNNABLE);
+	scheduler.add_to_runqueue(sleeper);
+
+	while (tick(scheduler) == &sleeper);
+
+	until = scheduler.next_preemption();
+	CHECK(until > 0 && until <= HALF_PERIOD);
+	CHECK(sched_next_preemption(until) && until > 0);
+}
+
+/**
+ * A round-robin entity can hand its timeslice to a server it has just woken, but a deadline entity running
+ * on its budget cannot lend that budget out.
+ */
+static void test_yield_to()
+{
+	RoundRobinScheduler scheduler;
+	SchedulingEntity client, server, hog, deadline;
+
+	scheduler.add_to_runqueue(client);
+	scheduler.add_to_runqueue(hog);
+	CHECK(tick(scheduler) == &client);
+
+	scheduler.add_to_runqueue(server);
+	CHECK(sched_yield_to(server));
+	CHECK(tick(scheduler) == &server);
+	CHECK(scheduler.directed_yields() == 1);
+
+	CHECK(scheduler.set_deadline(deadline, 1000000, HALF_PERIOD, HALF_PERIOD));
+	scheduler.add_to_runqueue(deadline);
+	CHECK(tick(scheduler) == &deadline);
+
+	client.set_state(SchedulingEntityState::SLEEPING);
+	scheduler.remove_from_runqueue(client);
+	scheduler.add_to_runqueue(client);
+	CHECK(!sched_yield_to(client));
+	CHECK(tick(scheduler) == &deadline);
+	CHECK(scheduler.directed_yields() == 1);
+}
+
+int main()
+{
+	test_exit();
+	test_no_false_misses();
+	test_real_miss();
+	test_controls();
+	test_rotation();
+	test_placements();
+	test_next_preemption();
+	test_yield_to();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,196 @@
+/*
+ * Checks that the stride scheduler hands out CPU time in proportion to tickets.
+ */
+#include <new>
+#include <stdlib.h>
+
+#include "test.h"
+#include "host-cpu.h"
+#include "../sched-stride.cpp"
+#include "../irq-trace.cpp"
+
+// The length of each simulated scheduling tick.
+#define TICK			STRIDE_QUANTUM
+
+// The most entities a single check can run.
+#define MAX_ENTITIES		8
+
+// How far (in ticks) an entity's CPU time may stray from its exact share, at any point.
+#define MAX_ERROR_TICKS		2
+
+/**
+ * Runs the given entities for a number of ticks, and checks that every entity stays within
+ * MAX_ERROR_TICKS of its share of the CPU throughout.
+ */
+static void check_shares(StrideScheduler& scheduler, SchedulingEntity *entities, const unsigned int *tickets,
+		int nr_entities, int nr_ticks)
+{
+	uint64_t start[MAX_ENTITIES];
+	unsigned int total_tickets = 0;
+
+	CHECK(nr_entities <= MAX_ENTITIES);
+
+	for (int i = 0; i < nr_entities; i++) {
+		start[i] = entities[i].cpu_runtime();
+		total_tickets += tickets[i];
+	}
+
+	double worst = 0;
+
+	for (int tick = 1; tick <= nr_ticks; tick++) {
+		scheduler.pick_next_entity()->run_for(TICK);
+
+		for (int i = 0; i < nr_entities; i++) {
+			double used = (entities[i].cpu_runtime() - start[i]) / (double)TICK;
+			double expected = (tick * (double)tickets[i]) / total_tickets;
+			double error = used > expected ? used - expected : expected - used;
+
+			if (error > worst) {
+				worst = error;
+			}
+		}
+	}
+
+	printf("  %d entities, %d ticks: worst error %.2f ticks\n", nr_entities, nr_ticks, worst);
+	CHECK(worst <= MAX_ERROR_TICKS);
+}
+
+/**
+ * Shares of 3:1:2 converge, and keep converging after the ratio changes.
+ */
+static void test_convergence()
+{
+	StrideScheduler scheduler;
+	SchedulingEntity entities[3];
+	unsigned int tickets[3] = { 300, 100, 200 };
+
+	for (int i = 0; i < 3; i++) {
+		CHECK(scheduler.set_tickets(entities[i], tickets[i]));
+		scheduler.add_to_runqueue(entities[i]);
+	}
+
+	check_shares(scheduler, entities, tickets, 3, 6000);
+
+	tickets[1] = 600;
+	CHECK(scheduler.set_tickets(entities[1], tickets[1]));
+	CHECK(scheduler.tickets(entities[1]) == 600);
+
+	check_shares(scheduler, entities, tickets, 3, 11000);
+}
+
+/**
+ * An entity that sleeps does not get to make up the time it missed when it wakes.
+ */
+static void test_sleeper()
+{
+	StrideScheduler scheduler;
+	SchedulingEntity entities[2];
+	unsigned int tickets[2] = { 100, 100 };
+
+	for (int i = 0; i < 2; i++) {
+		scheduler.add_to_runqueue(entities[i]);
+	}
+
+	scheduler.remove_from_runqueue(entities[1]);
+	for (int tick = 0; tick < 1000; tick++) {
+		CHECK(scheduler.pick_next_entity() == &entities[0]);
+		entities[0].run_for(TICK);
+	}
+
+	scheduler.add_to_runqueue(entities[1]);
+	check_shares(scheduler, entities, tickets, 2, 1000);
+}
+
+/**
+ * Stride state does not outlive its entity, whether the entity exits while runnable or asleep.
+ */
+static void test_entity_reuse()
+{
+	StrideScheduler scheduler;
+	SchedulingEntity unstarted, entity;
+
+	// An entity that has never been runnable exits.
+	CHECK(scheduler.set_tickets(unstarted, 500));
+	unstarted.set_state(SchedulingEntityState::STOPPED);
+	scheduler.remove_from_runqueue(unstarted);
+	CHECK(scheduler.tickets(unstarted) == DEFAULT_TICKETS);
+
+	// An entity that has been running exits, and is replaced at the same address.
+	CHECK(scheduler.set_tickets(entity, 500));
+	scheduler.add_to_runqueue(entity);
+	scheduler.pick_next_entity()->run_for(TICK);
+	scheduler.pick_next_entity();
+
+	entity.set_state(SchedulingEntityState::STOPPED);
+	scheduler.remove_from_runqueue(entity);
+
+	entity.~SchedulingEntity();
+	new (&entity) SchedulingEntity();
+
+	CHECK(scheduler.tickets(entity) == DEFAULT_TICKETS);
+	CHECK(scheduler.pick_next_entity() == nullptr);
+
+	// Going to sleep is not exiting.
+	CHECK(scheduler.set_tickets(entity, 500));
+	scheduler.add_to_runqueue(entity);
+	entity.set_state(SchedulingEntityState::SLEEPING);
+	scheduler.remove_from_runqueue(entity);
+	CHECK(scheduler.tickets(entity) == 500);
+}
+
+/**
+ * With several CPUs picking, no entity is ever picked by two CPUs at once, and the shares still hold.
+ */
+static void test_smp()
+{
+	StrideScheduler scheduler;
+	SchedulingEntity entities[3];
+
+	for (auto& entity : entities) {
+		scheduler.add_to_runqueue(entity);
+	}
+
+	for (int tick = 0; tick < 3000; tick++) {
+		test_cpu = 0;
+		auto first = scheduler.pick_next_entity();
+		test_cpu = 1;
+		auto second = scheduler.pick_next_entity();
+
+		CHECK(first && second && first != second);
+
+		first->run_for(TICK);
+		second->run_for(TICK);
+	}
+
+	// With two CPUs for three equal entities, each gets two thirds of a CPU.
+	for (auto& entity : entities) {
+		CHECK(entity.cpu_runtime() >= 1998 * TICK && entity.cpu_runtime() <= 2002 * TICK);
+	}
+
+	// A CPU with nothing left to pick idles, rather than sharing another CPU's entity.
+	entities[1].set_state(SchedulingEntityState::SLEEPING);
+	scheduler.remove_from_runqueue(entities[1]);
+	entities[2].set_state(SchedulingEntityState::SLEEPING);
+	scheduler.remove_from_runqueue(entities[2]);
+
+	test_cpu = 0;
+	auto running = scheduler.pick_next_entity();
+	test_cpu = 1;
+	CHECK(scheduler.pick_next_entity() == nullptr);
+	test_cpu = 0;
+	CHECK(scheduler.pick_next_entity() == running);
+	CHECK(running == &entities[0]);
+
+	CHECK(sched_set_tickets(entities[0], 200));
+	CHECK(scheduler.tickets(entities[0]) == 200);
+}
+
+int main()
+{
+	test_convergence();
+	test_sleeper();
+	test_entity_reuse();
+	test_smp();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,20 @@
+/*
+ * Minimal host-side test support.
+ */
+#pragma once
+
+#include <stdio.h>
+
+static int test_failures;
+
+// Records a failure, without stopping the test, if the condition does not hold.
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			test_failures++; \
+		} \
+	} while (0)
+
+// Returns the exit status of the test program.
+#define TEST_RESULT() (test_failures ? 1 : 0)
@@ -0,0 +1,81 @@
+/*
+ * Shared Time Page
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "tsc.h"
+
+#define TIME_PAGE_SIZE		0x1000
+
+/**
+ * The layout of the read-only page, shared between the kernel and every process, from which the
+ * current time can be worked out without entering the kernel.  The kernel rewrites it every time it
+ * reads the RTC; readers must use time_page_read() to get a consistent copy.
+ */
+struct TimePage
+{
+	// Odd whilst the kernel is rewriting the page.
+	volatile uint64_t sequence;
+
+	// The wall-clock time (in seconds since the UNIX epoch) when the RTC was last read, along with
+	// the kernel runtime (in nanoseconds) and TSC value at that moment.
+	uint64_t base_wall_seconds;
+	uint64_t base_runtime;
+	uint64_t base_tsc;
+
+	// The wall-clock time (in seconds since the UNIX epoch) that was already given out when the RTC
+	// was last read and turned out to be behind it.  The time is held here until the RTC catches up,
+	// so that it never goes backwards.  Zero if the time is not being held.
+	uint64_t floor_wall_seconds;
+
+	// How many TSC ticks there are in a second, as measured against the kernel's monotonic clock.
+	// Zero until the kernel has measured it, in which case the base values are used as they are.
+	uint64_t tsc_frequency;
+} __attribute__((aligned(TIME_PAGE_SIZE)));
+
+/**
+ * Works out the current time from the shared time page, without entering the kernel.
+ * @param page The shared time page.
+ * @param wall_seconds Populated with the wall-clock time, in seconds since the UNIX epoch.
+ * @param runtime Populated with the kernel's monotonic runtime, in nanoseconds.
+ */
+static inline void time_page_read(const TimePage *page, uint64_t& wall_seconds, uint64_t& runtime)
+{
+	uint64_t sequence, base_tsc, tsc_frequency, tsc, floor_wall_seconds;
+
+	do {
+		sequence = page->sequence;
+		__sync_synchronize();
+
+		wall_seconds = page->base_wall_seconds;
+		runtime = page->base_runtime;
+		base_tsc = page->base_tsc;
+		floor_wall_seconds = page->floor_wall_seconds;
+		tsc_frequency = page->tsc_frequency;
+		tsc = read_tsc();
+
+		__sync_synchronize();
+	} while ((sequence & 1) || sequence != page->sequence);
+
+	if (tsc_frequency && tsc > base_tsc) {
+		uint64_t ticks = tsc - base_tsc;
+
+		wall_seconds += ticks / tsc_frequency;
+		runtime += ((ticks / tsc_frequency) * 1000000000ULL) + (((ticks % tsc_frequency) * 1000000000ULL) / tsc_frequency);
+	}
+
+	if (wall_seconds < floor_wall_seconds) {
+		wall_seconds = floor_wall_seconds;
+	}
+}
+
+/**
+ * The kernel's copy of the time page, which is mapped read-only into every process.
+ */
+extern TimePage time_page;
@@ -0,0 +1,151 @@
+/*
+ * Hierarchical Timer Wheel
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#include "timer-wheel.h"
+
+/**
+ * Returns the slot of a given level that a time falls into.
+ */
+static inline unsigned int slot_of(uint64_t time, int level)
+{
+	return (time >> (level * TIMER_WHEEL_SLOT_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+}
+
+TimerWheel::TimerWheel() : _now(0), _count(0)
+{
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (unsigned int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+			_slots[level][slot]._next = &_slots[level][slot];
+			_slots[level][slot]._prev = &_slots[level][slot];
+		}
+	}
+}
+
+void TimerWheel::add(CoarseTimer& timer, uint64_t expires)
+{
+	if (timer.pending()) {
+		unlink(&timer);
+	}
+
+	// Timers already due expire on the next advance.
+	timer._expires = expires;
+	insert(&timer, expires > _now ? expires : _now + 1);
+}
+
+void TimerWheel::cancel(CoarseTimer& timer)
+{
+	if (timer.pending()) {
+		unlink(&timer);
+	}
+}
+
+void TimerWheel::insert(CoarseTimer *timer, uint64_t expires)
+{
+	uint64_t delta = expires - _now;
+
+	// Pick the finest level whose span covers the delay.  Anything too far out for even the
+	// coarsest level is parked in its furthest slot, and cascades down from there.
+	int level = 0;
+	while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << ((level + 1) * TIMER_WHEEL_SLOT_BITS))) {
+		level++;
+	}
+
+	unsigned int slot;
+	if (delta >= (1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS))) {
+		slot = (slot_of(_now, level) - 1) & (TIMER_WHEEL_SLOTS - 1);
+	} else {
+		slot = slot_of(expires, level);
+	}
+
+	CoarseTimer *head = &_slots[level][slot];
+	timer->_next = head;
+	timer->_prev = head->_prev;
+	head->_prev->_next = timer;
+	head->_prev = timer;
+
+	_count++;
+}
+
+void TimerWheel::unlink(CoarseTimer *timer)
+{
+	timer->_prev->_next = timer->_next;
+	timer->_next->_prev = timer->_prev;
+	timer->_next = nullptr;
+	timer->_prev = nullptr;
+
+	_count--;
+}
+
+void TimerWheel::cascade(int level, unsigned int slot)
+{
+	CoarseTimer *head = &_slots[level][slot];
+
+	while (head->_next != head) {
+		CoarseTimer *timer = head->_next;
+		unlink(timer);
+		insert(timer, timer->_expires);
+	}
+}
+
+void TimerWheel::advance(uint64_t now)
+{
+	while (_now < now) {
+		// With nothing pending, there is nothing to step through.
+		if (_count == 0) {
+			_now = now;
+			return;
+		}
+
+		_now++;
+
+		// Whenever a level wraps around, pull the next slot of the level above down into it.
+		for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+			if (slot_of(_now, level - 1) != 0) {
+				break;
+			}
+
+			cascade(level, slot_of(_now, level));
+		}
+
+		CoarseTimer *head = &_slots[0][slot_of(_now, 0)];
+		while (head->_next != head) {
+			CoarseTimer *timer = head->_next;
+			unlink(timer);
+
+			// The slot may also hold timers parked there from too far in the future.
+			if (timer->_expires > _now) {
+				insert(timer, timer->_expires);
+				continue;
+			}
+
+			timer->_callback(timer, timer->_priv);
+		}
+	}
+}
+
+uint64_t TimerWheel::next_expiry() const
+{
+	uint64_t earliest = TIMER_WHEEL_NONE;
+
+	if (_count == 0) {
+		return earliest;
+	}
+
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (unsigned int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+			const CoarseTimer *head = &_slots[level][slot];
+
+			for (const CoarseTimer *timer = head->_next; timer != head; timer = timer->_next) {
+				if (timer->_expires < earliest) {
+					earliest = timer->_expires;
+				}
+			}
+		}
+	}
+
+	return earliest;
+}
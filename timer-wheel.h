@@ -0,0 +1,121 @@
+/*
+ * Hierarchical Timer Wheel
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#pragma once
+
+#include <stdint.h>
+
+// The number of levels in the wheel, and the number of slots in each level (a power of two).  With
+// a one-second resolution, each level covers 64 times the span of the one below: just over a minute,
+// an hour, three days and six months.
+#define TIMER_WHEEL_LEVELS	4
+#define TIMER_WHEEL_SLOT_BITS	6
+#define TIMER_WHEEL_SLOTS	(1 << TIMER_WHEEL_SLOT_BITS)
+
+// Returned by next_expiry() when no timers are pending.
+#define TIMER_WHEEL_NONE	((uint64_t)-1)
+
+class CoarseTimer;
+
+typedef void (*CoarseTimerCallback)(CoarseTimer *timer, void *priv);
+
+/**
+ * A timer with a resolution of one second, for long sleeps and timeouts.  The timer is linked
+ * directly into the wheel, so adding and cancelling it never allocates.
+ */
+class CoarseTimer
+{
+	friend class TimerWheel;
+
+public:
+	CoarseTimer(CoarseTimerCallback callback = nullptr, void *priv = nullptr) : _next(nullptr), _prev(nullptr), _expires(0), _callback(callback), _priv(priv) { }
+
+	/**
+	 * Returns TRUE if the timer is waiting to expire.
+	 */
+	bool pending() const { return _prev != nullptr; }
+
+	/**
+	 * Returns the time (in seconds, on the wheel's clock) at which the timer expires.
+	 */
+	uint64_t expires() const { return _expires; }
+
+private:
+	CoarseTimer *_next;
+	CoarseTimer *_prev;
+	uint64_t _expires;
+
+	CoarseTimerCallback _callback;
+	void *_priv;
+};
+
+/**
+ * A hierarchical timer wheel.  Timers are placed into a slot according to how far in the future
+ * they expire, which makes adding and cancelling a timer O(1).  As time passes, timers in the
+ * coarser levels are cascaded down into finer levels, until they expire from the finest level.
+ * The wheel does not lock itself: callers must serialise access to it.
+ */
+class TimerWheel
+{
+public:
+	TimerWheel();
+
+	/**
+	 * Starts a timer.  If the timer is already pending, it is moved to the new expiry time.
+	 * @param timer The timer to start.
+	 * @param expires The time (in seconds, on the wheel's clock) at which the timer should expire.
+	 */
+	void add(CoarseTimer& timer, uint64_t expires);
+
+	/**
+	 * Stops a timer, if it is pending.
+	 * @param timer The timer to stop.
+	 */
+	void cancel(CoarseTimer& timer);
+
+	/**
+	 * Moves the wheel forwards, running the callback of every timer that has expired.
+	 * @param now The current time, in seconds, on the wheel's clock.
+	 */
+	void advance(uint64_t now);
+
+	/**
+	 * Returns the earliest time at which a pending timer expires, or TIMER_WHEEL_NONE if there are
+	 * no pending timers.
+	 */
+	uint64_t next_expiry() const;
+
+	/**
+	 * Returns the number of pending timers.
+	 */
+	unsigned int count() const { return _count; }
+
+private:
+	/**
+	 * Links a timer into the slot that suits an expiry time.
+	 * @param timer The timer to link in.
+	 * @param expires When the timer should expire; no earlier than the time the wheel is at.
+	 */
+	void insert(CoarseTimer *timer, uint64_t expires);
+
+	/**
+	 * Unlinks a timer from whichever slot it is in.
+	 */
+	void unlink(CoarseTimer *timer);
+
+	/**
+	 * Re-inserts every timer in a slot of a coarse level, which spreads them across the finer levels.
+	 */
+	void cascade(int level, unsigned int slot);
+
+	// Each slot is a circular list, headed by a sentinel timer.
+	CoarseTimer _slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+	// The time the wheel has been advanced to, and the number of pending timers.
+	uint64_t _now;
+	unsigned int _count;
+};
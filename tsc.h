@@ -0,0 +1,21 @@
+/*
+ * Time-stamp Counter
+ */
+
+/*
+ * STUDENT NUMBER: s1620208
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Reads the CPU's time-stamp counter.  This works in user mode too, so it is shared with the time page.
+ */
+static inline uint64_t read_tsc()
+{
+	uint32_t lo, hi;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+
+	return ((uint64_t)hi << 32) | lo;
+}